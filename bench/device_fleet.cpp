@@ -0,0 +1,215 @@
+#include "device_fleet.hpp"
+#include <bacnet/bacdef.h>
+#include <bacnet/apdu.h>
+#include <bacnet/npdu.h>
+#include <bacnet/basic/object/av.h>
+#include <bacnet/basic/object/device.h>
+#include <bacnet/basic/services.h>
+#include <bacnet/basic/tsm/tsm.h>
+#include <bacnet/datalink/bip.h>
+#include <bacnet/datalink/bvlc.h>
+#include <bacnet/datalink/datalink.h>
+#include <bacnet/datalink/dlenv.h>
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+const std::chrono::seconds announce_interval(30);
+
+int64_t to_ns(DeviceFleet::clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+bool parse_bridge(const std::string& bridge, BACNET_ADDRESS& dest) {
+    size_t colon = bridge.rfind(':');
+    BACNET_IP_ADDRESS address = {};
+    if (not bip_get_addr_by_name(bridge.substr(0, colon).c_str(), &address)) {
+        return false;
+    }
+    address.port = colon == std::string::npos ? 0xBAC0 : static_cast<uint16_t>(std::stoul(bridge.substr(colon + 1)));
+    return bvlc_ip_address_to_bacnet_local(&dest, &address);
+}
+
+}
+
+DeviceFleet::DeviceFleet(const fleet_config& config)
+    : _config(config)
+{
+}
+
+DeviceFleet::~DeviceFleet() {
+    stop();
+    if (_shared) {
+        munmap(_shared, _mapping_size);
+    }
+}
+
+DeviceFleet::change_record& DeviceFleet::record_(uint32_t index, uint32_t instance, uint64_t value) const {
+    return _records[(static_cast<size_t>(index) * _config.objects + instance) * history + value % history];
+}
+
+bool DeviceFleet::start() {
+    size_t records = static_cast<size_t>(_config.devices) * _config.objects * history;
+    size_t header = (sizeof(shared_state) + alignof(change_record) - 1) / alignof(change_record) * alignof(change_record);
+    _mapping_size = header + records * sizeof(change_record);
+    void *mapping = mmap(nullptr, _mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Unable to map the fleet state: %s\n", strerror(errno));
+        return false;
+    }
+    _shared = new (mapping) shared_state();
+    _shared->rate.store(_config.rate);
+    _records = reinterpret_cast<change_record *>(static_cast<char *>(mapping) + header);
+    for (size_t i = 0; i < records; i++) {
+        new (&_records[i]) change_record();
+    }
+    for (uint32_t index = 0; index < _config.devices; index++) {
+        fflush(nullptr);
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Unable to start device %u: %s\n", _config.first_device + index, strerror(errno));
+            stop();
+            return false;
+        }
+        if (pid == 0) {
+            run_device_(index);
+        }
+        _pids.push_back(pid);
+    }
+    return true;
+}
+
+void DeviceFleet::stop() {
+    if (_shared == nullptr or _pids.empty()) {
+        return;
+    }
+    _shared->stop.store(true);
+    for (pid_t pid: _pids) {
+        waitpid(pid, nullptr, 0);
+    }
+    _pids.clear();
+}
+
+void DeviceFleet::set_rate(double rate) {
+    _shared->rate.store(rate);
+}
+
+uint64_t DeviceFleet::changes() const {
+    return _shared->changes.load();
+}
+
+bool DeviceFleet::change_time(uint32_t device_id, uint32_t instance, uint64_t value, clock::time_point& time) const {
+    if (device_id < _config.first_device or device_id - _config.first_device >= _config.devices or instance >= _config.objects) {
+        return false;
+    }
+    const auto& record = record_(device_id - _config.first_device, instance, value);
+    if (record.value.load(std::memory_order_acquire) != value + 1) {
+        return false;
+    }
+    int64_t time_ns = record.time_ns.load(std::memory_order_relaxed);
+    /* overwritten while reading */
+    if (record.value.load(std::memory_order_acquire) != value + 1) {
+        return false;
+    }
+    time = clock::time_point(std::chrono::nanoseconds(time_ns));
+    return true;
+}
+
+void DeviceFleet::run_device_(uint32_t index) {
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    uint32_t device_id = _config.first_device + index;
+    setenv("BACNET_IP_PORT", std::to_string(_config.first_port + index).c_str(), 1);
+
+    Device_Set_Object_Instance_Number(device_id);
+    Device_Init(nullptr);
+    for (uint32_t instance = 0; instance < _config.objects; instance++) {
+        Analog_Value_Create(instance);
+        Analog_Value_Present_Value_Set(instance, 0, BACNET_MAX_PRIORITY);
+        /* every step of one is a change of value */
+        Analog_Value_COV_Increment_Set(instance, 0.5f);
+    }
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_WHO_IS, handler_who_is);
+    apdu_set_unrecognized_service_handler_handler(handler_unrecognized_service);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_READ_PROPERTY, handler_read_property);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_READ_PROP_MULTIPLE, handler_read_property_multiple);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_WRITE_PROPERTY, handler_write_property);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_WRITE_PROP_MULTIPLE, handler_write_property_multiple);
+    apdu_set_confirmed_handler(SERVICE_CONFIRMED_SUBSCRIBE_COV, handler_cov_subscribe);
+    handler_cov_init();
+    dlenv_init();
+
+    BACNET_ADDRESS bridge = {};
+    bool announce = parse_bridge(_config.bridge, bridge);
+    if (not announce) {
+        fprintf(stderr, "Device %u: unable to resolve the bridge %s\n", device_id, _config.bridge.c_str());
+    }
+    static uint8_t rx_buffer[MAX_MPDU];
+    std::vector<uint64_t> counters(_config.objects);
+    uint32_t next_object = 0;
+    double due = 0;
+    auto now = clock::now();
+    auto last_change = now;
+    auto last_tsm = now;
+    auto last_cov_timer = now;
+    auto next_announce = now;
+    while (not _shared->stop.load(std::memory_order_relaxed)) {
+        BACNET_ADDRESS src = {};
+        uint16_t pdu_len = datalink_receive(&src, rx_buffer, sizeof(rx_buffer), 1);
+        if (pdu_len > 0) {
+            npdu_handler(&src, rx_buffer, pdu_len);
+        }
+        now = clock::now();
+        if (announce and now >= next_announce) {
+            Send_I_Am_Unicast(&Handler_Transmit_Buffer[0], &bridge);
+            next_announce = now + announce_interval;
+        }
+        auto tsm_elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_tsm);
+        if (tsm_elapsed.count() >= 10) {
+            tsm_timer_milliseconds(static_cast<uint16_t>(tsm_elapsed.count()));
+            last_tsm += tsm_elapsed;
+        }
+        auto cov_elapsed = std::chrono::duration_cast<std::chrono::seconds>(now - last_cov_timer);
+        if (cov_elapsed.count() > 0) {
+            handler_cov_timer_seconds(static_cast<uint32_t>(cov_elapsed.count()));
+            last_cov_timer += cov_elapsed;
+        }
+
+        /* token bucket, a stall does not turn into a burst larger than one
+         * change per object */
+        double rate = _shared->rate.load(std::memory_order_relaxed) / _config.devices;
+        due = std::min(due + rate * std::chrono::duration<double>(now - last_change).count(), double(_config.objects));
+        last_change = now;
+        bool changed = false;
+        while (due >= 1 and _config.objects > 0) {
+            due -= 1;
+            uint32_t instance = next_object;
+            next_object = (next_object + 1) % _config.objects;
+            uint64_t value = ++counters[instance];
+            auto& record = record_(index, instance, value);
+            record.value.store(0, std::memory_order_relaxed);
+            record.time_ns.store(to_ns(clock::now()), std::memory_order_relaxed);
+            record.value.store(value + 1, std::memory_order_release);
+            Analog_Value_Present_Value_Set(instance, static_cast<float>(value), BACNET_MAX_PRIORITY);
+            _shared->changes.fetch_add(1, std::memory_order_relaxed);
+            changed = true;
+        }
+        if (changed) {
+            /* one full pass over the subscriptions sends the notifications */
+            while (not handler_cov_fsm()) {
+            }
+        }
+    }
+    datalink_cleanup();
+    _exit(0);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+struct fleet_config {
+    uint32_t first_device = 100000;
+    uint32_t devices = 10;
+    /* analog values per device, bacnet-stack keeps MAX_COV_SUBCRIPTIONS
+     * (128 by default) subscriptions per device */
+    uint32_t objects = 10;
+    /* device i listens on first_port + i */
+    uint16_t first_port = 47900;
+    /* the bridge, the devices announce themselves to it with a unicast I-Am
+     * since its broadcasts do not reach other ports */
+    std::string bridge = "127.0.0.1:47808";
+    /* present value changes per second over the whole fleet */
+    double rate = 100;
+};
+
+/* Simulated BACnet/IP devices on loopback, one process per device because
+ * bacnet-stack keeps a single device object in globals. Each device runs the
+ * stack's own server objects and handlers: M analog values with a COV
+ * increment below one, ReadProperty(Multiple), WriteProperty and
+ * SubscribeCOV. Present values count up by one per change so every change
+ * is a COV notification and the published value identifies the change.
+ *
+ * The change times live in shared memory, indexed by point and the low bits
+ * of the value, so a consumer can compute change -> publish latency. */
+class DeviceFleet {
+public:
+    typedef std::chrono::steady_clock clock;
+    /* change times kept per point, a value older than this can not be timed */
+    static constexpr uint32_t history = 64;
+
+    explicit DeviceFleet(const fleet_config& config);
+    ~DeviceFleet();
+    DeviceFleet(const DeviceFleet&) = delete;
+    DeviceFleet& operator=(const DeviceFleet&) = delete;
+
+    /* forks the devices, false when that failed */
+    bool start();
+    void stop();
+    void set_rate(double rate);
+    uint64_t changes() const;
+    /* when the point was set to value, false when unknown or overwritten */
+    bool change_time(uint32_t device_id, uint32_t instance, uint64_t value, clock::time_point& time) const;
+    const fleet_config& config() const {
+        return _config;
+    }
+
+private:
+    struct shared_state {
+        std::atomic<double> rate;
+        std::atomic<bool> stop;
+        std::atomic<uint64_t> changes;
+    };
+    struct change_record {
+        /* value + 1, 0 for none */
+        std::atomic<uint64_t> value;
+        std::atomic<int64_t> time_ns;
+    };
+
+    fleet_config _config;
+    shared_state *_shared = nullptr;
+    change_record *_records = nullptr;
+    size_t _mapping_size = 0;
+    std::vector<pid_t> _pids;
+
+    change_record& record_(uint32_t index, uint32_t instance, uint64_t value) const;
+    [[noreturn]] void run_device_(uint32_t index);
+};
@@ -0,0 +1,50 @@
+/* Load generator: N simulated BACnet/IP devices with M analog values each,
+ * changing present values at a fixed rate until interrupted.
+ *
+ *   device-fleet [devices] [objects] [changes/s]
+ *
+ * BACNET_FLEET_BRIDGE (127.0.0.1:47808) is where the devices announce
+ * themselves, BACNET_FLEET_PORT (47900) the UDP port of the first device. */
+#include "device_fleet.hpp"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+static volatile sig_atomic_t stopping = 0;
+
+int main(int argc, char *argv[]) {
+    fleet_config config;
+    if (argc > 1) {
+        config.devices = std::strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        config.objects = std::strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3) {
+        config.rate = std::strtod(argv[3], nullptr);
+    }
+    if (const char *bridge = std::getenv("BACNET_FLEET_BRIDGE")) {
+        config.bridge = bridge;
+    }
+    if (const char *port = std::getenv("BACNET_FLEET_PORT")) {
+        config.first_port = static_cast<uint16_t>(std::strtoul(port, nullptr, 10));
+    }
+    DeviceFleet fleet(config);
+    if (not fleet.start()) {
+        return 1;
+    }
+    signal(SIGINT, [](int) { stopping = 1; });
+    signal(SIGTERM, [](int) { stopping = 1; });
+    printf("%u devices with %u objects each, %.0f changes/s\n", config.devices, config.objects, config.rate);
+    uint64_t changes = 0;
+    while (not stopping) {
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+        uint64_t total = fleet.changes();
+        printf("%.1f changes/s, %llu total\n", (total - changes) / 10.0, static_cast<unsigned long long>(total));
+        fflush(stdout);
+        changes = total;
+    }
+    fleet.stop();
+    return 0;
+}
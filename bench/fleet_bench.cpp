@@ -0,0 +1,189 @@
+/* End to end benchmark: runs a simulated device fleet against a running
+ * bacnet-mqtt (built with BACNET_MQTT_BIP, BACNET_IFACE=lo) and measures the
+ * change -> MQTT publish latency and the delivered rate at each offered rate.
+ *
+ *   fleet-bench [devices] [objects] [rate,rate,...] [seconds per step]
+ *
+ * The bridge has to publish text payloads without deadband or rate limits.
+ * MQTT_HOST, MQTT_PORT, BACNET_TOPIC_PREFIX, BACNET_FLEET_BRIDGE and
+ * BACNET_FLEET_PORT are read from the environment. The highest rate where
+ * at least 99% of the changes arrived is reported as the sustained
+ * throughput. */
+#include "device_fleet.hpp"
+#include <mosquitto.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct measurement {
+    std::mutex mutex;
+    const DeviceFleet *fleet;
+    std::string prefix;
+    /* latencies of the current step in microseconds */
+    std::vector<double> latencies;
+    uint64_t received = 0;
+    uint64_t untimed = 0;
+    /* points heard from during the warm up */
+    std::set<std::pair<uint32_t, uint32_t>> seen;
+};
+
+void on_message(struct mosquitto *, void *userdata, const struct mosquitto_message *msg) {
+    auto now = DeviceFleet::clock::now();
+    auto *state = static_cast<measurement *>(userdata);
+    /* <prefix>bacnet-out/<device>/<type>/<instance> */
+    const char *topic = msg->topic + state->prefix.size();
+    const char *device = strchr(topic, '/');
+    const char *instance = device ? strrchr(device, '/') : nullptr;
+    if (instance == nullptr or instance == device) {
+        return;
+    }
+    uint32_t device_id = std::strtoul(device + 1, nullptr, 10);
+    uint32_t object = std::strtoul(instance + 1, nullptr, 10);
+    std::string payload(static_cast<const char *>(msg->payload), msg->payloadlen);
+    uint64_t value = static_cast<uint64_t>(std::strtod(payload.c_str(), nullptr));
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    state->seen.emplace(device_id, object);
+    state->received++;
+    DeviceFleet::clock::time_point changed;
+    if (value > 0 and state->fleet->change_time(device_id, object, value, changed)) {
+        state->latencies.push_back(std::chrono::duration<double, std::micro>(now - changed).count());
+    } else {
+        state->untimed++;
+    }
+}
+
+double percentile(const std::vector<double>& sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(fraction * sorted.size()))];
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    fleet_config config;
+    config.rate = 0;
+    std::vector<double> rates = {100, 200, 500, 1000, 2000, 5000};
+    unsigned step_seconds = 20;
+    if (argc > 1) {
+        config.devices = std::strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        config.objects = std::strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3) {
+        rates.clear();
+        for (char *rate = strtok(argv[3], ","); rate != nullptr; rate = strtok(nullptr, ",")) {
+            rates.push_back(std::strtod(rate, nullptr));
+        }
+    }
+    if (argc > 4) {
+        step_seconds = std::strtoul(argv[4], nullptr, 10);
+    }
+    if (const char *bridge = std::getenv("BACNET_FLEET_BRIDGE")) {
+        config.bridge = bridge;
+    }
+    if (const char *port = std::getenv("BACNET_FLEET_PORT")) {
+        config.first_port = static_cast<uint16_t>(std::strtoul(port, nullptr, 10));
+    }
+    const char *mqtt_host = std::getenv("MQTT_HOST");
+    const char *mqtt_port = std::getenv("MQTT_PORT");
+    const char *topic_prefix = std::getenv("BACNET_TOPIC_PREFIX");
+
+    DeviceFleet fleet(config);
+    measurement state;
+    state.fleet = &fleet;
+    state.prefix = std::string(topic_prefix ? topic_prefix : "") + "bacnet-out/";
+
+    mosquitto_lib_init();
+    struct mosquitto *mosq = mosquitto_new(nullptr, true, &state);
+    mosquitto_message_callback_set(mosq, on_message);
+    if (mosquitto_connect(mosq, mqtt_host ? mqtt_host : "localhost", mqtt_port ? std::atoi(mqtt_port) : 1883, 60) != MOSQ_ERR_SUCCESS) {
+        fprintf(stderr, "Unable to connect to the broker\n");
+        return 1;
+    }
+    mosquitto_subscribe(mosq, nullptr, (state.prefix + "#").c_str(), 0);
+    mosquitto_loop_start(mosq);
+    if (not fleet.start()) {
+        return 1;
+    }
+
+    /* every point publishes its initial value once subscribed */
+    size_t points = static_cast<size_t>(config.devices) * config.objects;
+    printf("Waiting for %zu points to be subscribed\n", points);
+    for (unsigned waited = 0;; waited++) {
+        size_t seen;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            seen = state.seen.size();
+        }
+        if (seen >= points) {
+            break;
+        }
+        if (waited == 300) {
+            fprintf(stderr, "Only %zu of %zu points showed up\n", seen, points);
+            fleet.stop();
+            return 1;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    printf("%10s %10s %10s %8s %9s %9s %9s %9s %9s\n",
+           "rate", "offered/s", "delivered", "ratio", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+    double sustained = 0;
+    for (double rate: rates) {
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            state.latencies.clear();
+            state.received = 0;
+            state.untimed = 0;
+        }
+        uint64_t changes = fleet.changes();
+        fleet.set_rate(rate);
+        std::this_thread::sleep_for(std::chrono::seconds(step_seconds));
+        fleet.set_rate(0);
+        uint64_t offered = fleet.changes() - changes;
+        /* let the tail of this step arrive */
+        std::this_thread::sleep_for(std::chrono::seconds(2));
+        std::vector<double> latencies;
+        uint64_t received;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            latencies.swap(state.latencies);
+            received = state.received;
+        }
+        std::sort(latencies.begin(), latencies.end());
+        double ratio = offered ? static_cast<double>(received) / offered : 0;
+        printf("%10.0f %10.1f %10.1f %8.3f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+               rate,
+               static_cast<double>(offered) / step_seconds,
+               static_cast<double>(received) / step_seconds,
+               ratio,
+               percentile(latencies, 0.5) / 1000,
+               percentile(latencies, 0.9) / 1000,
+               percentile(latencies, 0.99) / 1000,
+               percentile(latencies, 0.999) / 1000,
+               latencies.empty() ? 0 : latencies.back() / 1000);
+        fflush(stdout);
+        if (ratio >= 0.99) {
+            sustained = std::max(sustained, static_cast<double>(offered) / step_seconds);
+        }
+    }
+    printf("Max sustained throughput: %.1f changes/s\n", sustained);
+
+    fleet.stop();
+    mosquitto_loop_stop(mosq, true);
+    mosquitto_destroy(mosq);
+    mosquitto_lib_cleanup();
+    return 0;
+}
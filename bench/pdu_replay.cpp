@@ -0,0 +1,105 @@
+/* Replays a PDU trace captured with BACNET_CAPTURE through the regular
+ * handlers (I-Am, ReadProperty(Multiple) acks, COV notifications, ...) with a
+ * stub publisher and reports the decode -> publish throughput and the heap
+ * allocations per notification.
+ *
+ *   pdu-replay <trace> [passes] [speed]
+ *
+ * speed 0 replays as fast as possible, 1 in real time, 2 twice as fast and
+ * so on. The trace is read into memory first. Set BACNET_SNAPSHOT to the
+ * snapshot of the capturing bridge when the trace starts after discovery,
+ * the other BACNET_* settings apply as usual. */
+#include "bacnet.hpp"
+#include "pdu_trace.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+struct sink_stats {
+    size_t count;
+    size_t bytes;
+};
+
+static void sink(void *context, point_id, const std::string& topic, std::string_view value) {
+    auto *stats = static_cast<sink_stats *>(context);
+    stats->count++;
+    stats->bytes += topic.size() + value.size();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [passes] [speed]\n", argv[0]);
+        return 2;
+    }
+    unsigned passes = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1;
+    double speed = argc > 3 ? std::strtod(argv[3], nullptr) : 0;
+
+    std::vector<pdu_record> records;
+    {
+        PduTraceReader reader;
+        if (not reader.open(argv[1])) {
+            return 1;
+        }
+        pdu_record record;
+        while (reader.next(record)) {
+            records.push_back(record);
+        }
+    }
+    if (records.empty()) {
+        fprintf(stderr, "Empty trace\n");
+        return 1;
+    }
+    printf("%zu PDUs over %.1f s\n", records.size(), (records.back().time_ns - records.front().time_ns) / 1e9);
+
+    sink_stats stats = {};
+    bacnet_replay_init(sink, &stats, "bacnet-out/");
+    for (unsigned pass = 1; pass <= passes; pass++) {
+        size_t notifications = stats.count;
+        size_t before = allocations.load();
+        auto start = std::chrono::steady_clock::now();
+        for (auto& record: records) {
+            if (speed > 0) {
+                auto offset = std::chrono::nanoseconds(
+                    static_cast<int64_t>((record.time_ns - records.front().time_ns) / speed));
+                std::this_thread::sleep_until(start + offset);
+            }
+            bacnet_replay_pdu(&record.src, record.pdu, record.pdu_len);
+        }
+        auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        size_t pass_allocations = allocations.load() - before;
+        notifications = stats.count - notifications;
+        printf(
+            "pass %u: %.0f PDUs/s, %zu notifications, %.0f notifications/s, %zu allocations (%.2f per notification)\n",
+            pass,
+            records.size() / elapsed,
+            notifications,
+            notifications / elapsed,
+            pass_allocations,
+            notifications ? static_cast<double>(pass_allocations) / notifications : 0.0
+        );
+    }
+    return stats.count > 0 ? 0 : 1;
+}
@@ -0,0 +1,123 @@
+/* Microbenchmark of the COV -> MQTT publish path: point lookup, value
+ * formatting and handler dispatch, as done by ccov_notification_handle().
+ * Counts heap allocations through a replaced global operator new and fails
+ * if the hot path allocates. The legacy string based path is measured for
+ * comparison. */
+#include "point_table.hpp"
+#include "value_format.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+static std::atomic<size_t> allocations{0};
+
+void *operator new(size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+struct sink_stats {
+    size_t count;
+    size_t bytes;
+};
+
+static void sink(void *context, const std::string& topic, std::string_view value) {
+    auto *stats = static_cast<sink_stats *>(context);
+    stats->count++;
+    stats->bytes += topic.size() + value.size();
+}
+
+static std::vector<BACNET_APPLICATION_DATA_VALUE> make_values() {
+    std::vector<BACNET_APPLICATION_DATA_VALUE> values(5);
+    values[0].tag = BACNET_APPLICATION_TAG_REAL;
+    values[0].type.Real = 21.37f;
+    values[1].tag = BACNET_APPLICATION_TAG_UNSIGNED_INT;
+    values[1].type.Unsigned_Int = 1234567;
+    values[2].tag = BACNET_APPLICATION_TAG_ENUMERATED;
+    values[2].type.Enumerated = 1;
+    values[3].tag = BACNET_APPLICATION_TAG_BOOLEAN;
+    values[3].type.Boolean = true;
+    values[4].tag = BACNET_APPLICATION_TAG_DOUBLE;
+    values[4].type.Double = 1013.25;
+    return values;
+}
+
+int main(int argc, char *argv[]) {
+    const uint32_t devices = 64;
+    const uint32_t objects = 64;
+    const size_t iterations = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000000;
+
+    PointTable table;
+    for (uint32_t device_id = 1; device_id <= devices; device_id++) {
+        for (uint32_t instance = 0; instance < objects; instance++) {
+            table.intern(device_id, {.type = OBJECT_ANALOG_INPUT, .instance = instance});
+        }
+    }
+    auto values = make_values();
+    static char buffer[value_buffer_size];
+    sink_stats stats = {};
+
+    size_t before = allocations.load();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        uint32_t device_id = 1 + i % devices;
+        BACNET_OBJECT_ID object = {.type = OBJECT_ANALOG_INPUT, .instance = static_cast<uint32_t>((i / devices) % objects)};
+        point_id point = table.find(device_id, object);
+        size_t len = format_value(values[i % values.size()], buffer, sizeof(buffer));
+        /* last value cache, published from there */
+        table.value[point].assign(buffer, len);
+        sink(&stats, table.info(point).topic, table.value[point]);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    size_t hot_allocations = allocations.load() - before;
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    printf("publish path: %.1f ns/notification, %zu allocations in %zu notifications\n", ns, hot_allocations, iterations);
+
+    /* the previous implementation: to_string, concatenated topic, std::function */
+    std::function<void(uint32_t, const std::string&, uint32_t, std::string)> legacy =
+        [&stats](uint32_t id, const std::string& type, uint32_t instance, std::string value) {
+            std::string topic = "bacnet-out/" + std::to_string(id) + "/" + type + "/" + std::to_string(instance);
+            sink(&stats, topic, value);
+        };
+    before = allocations.load();
+    start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        const auto& value = values[i % values.size()];
+        std::string text;
+        switch (value.tag) {
+            case BACNET_APPLICATION_TAG_REAL: text = std::to_string(value.type.Real); break;
+            case BACNET_APPLICATION_TAG_DOUBLE: text = std::to_string(value.type.Double); break;
+            case BACNET_APPLICATION_TAG_UNSIGNED_INT: text = std::to_string(value.type.Unsigned_Int); break;
+            case BACNET_APPLICATION_TAG_BOOLEAN: text = std::to_string(value.type.Boolean); break;
+            default: text = std::to_string(value.type.Enumerated); break;
+        }
+        legacy(1 + i % devices, bactext_object_type_name(OBJECT_ANALOG_INPUT), (i / devices) % objects, text);
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+    size_t legacy_allocations = allocations.load() - before;
+    ns = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+    printf("legacy path:  %.1f ns/notification, %zu allocations in %zu notifications\n", ns, legacy_allocations, iterations);
+
+    if (stats.count != 2 * iterations) {
+        return 2;
+    }
+    return hot_allocations == 0 ? 0 : 1;
+}
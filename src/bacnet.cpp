@@ -1,4 +1,15 @@
 #include "bacnet.hpp"
+#include "deadline_queue.hpp"
+#include "pacer.hpp"
+#include "snapshot.hpp"
+#include "poller.hpp"
+#include "point_table.hpp"
+#include "value_format.hpp"
+#include "payload.hpp"
+#include "pdu_trace.hpp"
+#include "point_filter.hpp"
+#include <array>
+#include <atomic>
 #include <cstdint>
 #include <iostream>
 #include <unordered_map>
@@ -6,58 +17,770 @@
 #include <vector>
 #include <algorithm>
 #include <chrono>
+#include <random>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 /* buffer used for receive */
 static uint8_t Rx_Buf[MAX_MPDU] = { 0 };
 
+/* PDUs handed over from the receive thread to the reactor thread */
+struct rx_packet {
+    BACNET_ADDRESS src;
+    uint16_t pdu_len;
+    uint8_t pdu[MAX_MPDU];
+};
+static rx_packet rx_queue[16];
+static size_t rx_head = 0;
+static size_t rx_count = 0;
+static std::mutex rx_mutex;
+static std::condition_variable rx_space;
+static int rx_event_fd = -1;
+/* counted on the receive thread */
+static std::atomic<uint64_t> pdus_received{0};
+
+/* every received PDU when BACNET_CAPTURE is set */
+static PduTraceWriter capture;
+
+/* writes coming from MQTT, drained on the BACnet thread */
+static CommandQueue<write_command, 256> write_queue;
+static CommandQueue<read_command, 64> read_queue;
+
 /* debug info printing */
 static bool BACnet_Debug_Enabled;
 
 /* timers */
-static struct mstimer subscription_timer = { 0 }; 
 static struct mstimer who_is_timer = { 0 }; 
+static struct mstimer snapshot_timer = { 0 };
 static struct mstimer datalink_timer = { 0 };
 static struct mstimer tsm_timer = { 0 };
 static ccov_notification_handler ccov_notification_handler_ = nullptr;
+static void *ccov_notification_context_ = nullptr;
+static ccov_notification_handler read_handler_ = nullptr;
+static void *read_context_ = nullptr;
+
+/* every confirmed request goes through the pacer */
+static RequestPacer pacer;
+/* per request state the reply handlers fill in, by invoke id: the replies
+ * a request_task awaits, property for ReadProperty, and the first failed
+ * write of a WritePropertyMultiple. Whatever answers the invoke id clears
+ * its entry. */
+struct awaited_request {
+    request_reply *reply;
+    property_reply *property;
+    BACNET_OBJECT_ID *failed_write;
+};
+static std::array<awaited_request, 256> awaited_requests;
+
+static awaited_request take_awaited(uint8_t invoke_id)
+{
+    awaited_request awaited = awaited_requests[invoke_id];
+    awaited_requests[invoke_id] = {};
+    return awaited;
+}
+
+/* the reply of a request whose invoke id the stack handed out again */
+static void clear_awaited(uint8_t invoke_id)
+{
+    awaited_requests[invoke_id] = {};
+}
+
+/* discovered: I-Am seen, object list not (completely) read yet
+ * enumerating: object list being read
+ * online: enumerated and heard from within device_stale_after
+ * stale: silent for device_stale_after, targeted Who-Is sent with backoff
+ * offline: device_offline_attempts Who-Is unanswered, its points are parked
+ *          and the object list is read again when it is back */
+enum class device_state : uint8_t {
+    discovered,
+    enumerating,
+    online,
+    stale,
+    offline
+};
 
 struct device_entry {
-    std::vector<BACNET_OBJECT_ID> object_list;
+    /* the device's objects except the device object itself */
+    std::vector<point_id> points;
+    /* discovery progress, elements 1 .. next_index - 1 have been read */
+    uint32_t object_count;
+    uint32_t next_index;
+    uint32_t batch_size;
+    /* the object list is read with ReadPropertyMultiple */
+    bool discovery_rpm;
+    device_state state;
+    /* an online event was published and no offline event since */
+    bool announced;
+    /* I-Am, any reply or a COV notification */
+    std::chrono::steady_clock::time_point last_seen;
+    /* the one liveness_queue entry which is not stale */
+    std::chrono::steady_clock::time_point check_at;
+    unsigned who_is_attempts;
+    uint32_t database_revision;
+    bool revision_known;
+    std::chrono::steady_clock::time_point revision_checked;
+    /* loaded from the snapshot, not yet confirmed by the device */
+    bool cached;
+    /* WritePropertyMultiple was rejected, writes go one by one */
+    bool wpm_unsupported;
+    /* a ReadPropertyMultiple poll was rejected, polls go one by one */
+    bool rpm_poll_unsupported;
+    /* writes per WritePropertyMultiple, 0 until an abort shrinks it */
+    uint32_t write_batch_size;
 };
 std::unordered_map<uint32_t, device_entry> device_map;
 
-struct cov_entry {
-    std::chrono::time_point<std::chrono::system_clock> subscribe_end;
-    long tag;
-};
-template <>
-struct std::hash<std::pair<uint32_t, BACNET_OBJECT_ID>>
+/* every point of every device, addressed by point id */
+static PointTable points;
+
+/* COV subscriptions, renewals are spread over [1/2, 4/5] of the lifetime */
+static const uint32_t cov_lifetime = 300;
+/* subscriberProcessIdentifier of every subscription, BACNET_SUBSCRIBER_ID or
+ * kept in the snapshot so a restarted bridge renews its earlier
+ * subscriptions instead of adding to the device's subscription table */
+static uint32_t subscriber_id = 0;
+/* notifications for another process identifier come from subscriptions an
+ * earlier identity left behind, cancelled once per point and identifier */
+static std::unordered_set<uint64_t> orphan_cancels;
+static uint64_t orphans_cancelled = 0;
+/* SIGTERM: subscriptions are cancelled and nothing new is started */
+static bool shutting_down = false;
+static std::chrono::steady_clock::time_point shutdown_deadline;
+static uint64_t cov_slot_exhausted = 0;
+static DeadlineQueue<point_id> renewal_queue;
+static std::minstd_rand renewal_rng{std::random_device{}()};
+static std::chrono::milliseconds renewal_lag{0};
+
+/* BACNET_COV_MODE=unconfirmed saves the SimpleAck of every notification;
+ * a notification can then get lost unnoticed, so the initial notification
+ * the device owes after every (re)subscription is awaited and the present
+ * value read when it does not come within resync_after */
+static bool cov_confirmed = true;
+static const std::chrono::seconds resync_after{10};
+static DeadlineQueue<point_id> resync_queue;
+static uint64_t resync_reads = 0;
+
+/* BACNET_POINTS, applied to every point found in an object list */
+static PointFilter point_filter;
+static std::string point_filter_path;
+
+/* polling fallback for objects which reject SubscribeCOV */
+static PointPoller poller;
+
+static void start_polling(point_id point);
+static void send_cov_subscribe(point_id point);
+static void send_cov_cancel(point_id point);
+
+static void stop_polling(point_id point)
 {
-  std::size_t operator()(const std::pair<uint32_t, BACNET_OBJECT_ID>& k) const
-  {
-    return std::hash<uint32_t>()(k.first) ^ std::hash<int>()(static_cast<int>(k.second.type)) ^ std::hash<uint32_t>()(k.second.instance);
-  }
-};
-bool operator==(const BACNET_OBJECT_ID& lhs, const BACNET_OBJECT_ID& rhs) {
-    return lhs.type == rhs.type and lhs.instance == rhs.instance;
+    if (points.flags[point] & POINT_POLLED) {
+        const auto& info = points.info(point);
+        poller.remove(info.device_id, info.object);
+    }
+    points.flags[point] &= ~(POINT_POLLED | POINT_COV_RETRY);
 }
-std::unordered_map<std::pair<uint32_t, BACNET_OBJECT_ID>, cov_entry> cov_map;
 
-static void device_map_add(uint32_t device_id)
+static void cov_subscribed(point_id point, const request_reply& reply)
+{
+    request_result result = reply.result;
+    auto now = std::chrono::steady_clock::now();
+    points.flags[point] &= ~POINT_SUBSCRIBE_PENDING;
+    if ((points.flags[point] & POINT_EXCLUDED) or shutting_down) {
+        /* deselected or shutting down while the request was out */
+        if (result == request_result::ack) {
+            send_cov_cancel(point);
+        }
+        return;
+    }
+    if (device_map[points.info(point).device_id].state == device_state::offline) {
+        /* parked until the device is back */
+        return;
+    }
+    if (result == request_result::ack) {
+        /* ends the polling of a point which waited for a free COV slot */
+        stop_polling(point);
+        std::uniform_int_distribution<long> spread(cov_lifetime * 1000 / 2, cov_lifetime * 1000 * 4 / 5);
+        points.subscribe_end[point] = now + std::chrono::seconds(cov_lifetime);
+        points.renew_at[point] = now + std::chrono::milliseconds(spread(renewal_rng));
+        if (not cov_confirmed) {
+            points.flags[point] |= POINT_AWAITING_NOTIFICATION;
+            resync_queue.schedule(point, now + resync_after);
+        }
+    } else if (result == request_result::timeout) {
+        points.renew_at[point] = now + std::chrono::seconds(30);
+    } else if (result == request_result::error and reply.error_class == ERROR_CLASS_RESOURCES) {
+        /* subscription table full, e.g. with orphans of a crashed bridge
+         * which expire within a lifetime; poll until then */
+        cov_slot_exhausted++;
+        if (not (points.flags[point] & POINT_POLLED)) {
+            start_polling(point);
+        }
+        points.flags[point] |= POINT_COV_RETRY;
+        points.renew_at[point] = now + std::chrono::seconds(cov_lifetime);
+    } else if (points.cov_increment[point] > 0) {
+        /* no SubscribeCOVProperty, settle for the device's own increment */
+        points.cov_increment[point] = 0;
+        send_cov_subscribe(point);
+        return;
+    } else {
+        /* the device refuses COV for this object */
+        points.flags[point] &= ~POINT_COV_RETRY;
+        if (not (points.flags[point] & POINT_POLLED)) {
+            start_polling(point);
+        }
+        return;
+    }
+    renewal_queue.schedule(point, points.renew_at[point]);
+}
+
+/* Send_COV_Subscribe() for SubscribeCOVProperty, which the stack has no
+ * client side for */
+static uint8_t send_cov_subscribe_property(uint32_t device_id, BACNET_SUBSCRIBE_COV_DATA *cov_data)
 {
+    BACNET_ADDRESS dest;
+    unsigned max_apdu = 0;
+    if (not dcc_communication_enabled() or not address_get_by_device(device_id, &max_apdu, &dest)) {
+        return 0;
+    }
+    uint8_t invoke_id = tsm_next_free_invokeID();
+    if (invoke_id == 0) {
+        return 0;
+    }
+    BACNET_ADDRESS my_address;
+    BACNET_NPDU_DATA npdu_data;
+    datalink_get_my_address(&my_address);
+    npdu_encode_npdu_data(&npdu_data, true, MESSAGE_PRIORITY_NORMAL);
+    int pdu_len = npdu_encode_pdu(&Handler_Transmit_Buffer[0], &dest, &my_address, &npdu_data);
+    int len = cov_subscribe_property_encode_apdu(
+        &Handler_Transmit_Buffer[pdu_len], sizeof(Handler_Transmit_Buffer) - pdu_len, invoke_id, cov_data);
+    if (len <= 0 or static_cast<unsigned>(pdu_len + len) >= max_apdu) {
+        tsm_free_invoke_id(invoke_id);
+        return 0;
+    }
+    pdu_len += len;
+    tsm_set_confirmed_unsegmented_transaction(invoke_id, &dest, &npdu_data, &Handler_Transmit_Buffer[0], static_cast<uint16_t>(pdu_len));
+    if (datalink_send_pdu(&dest, &npdu_data, &Handler_Transmit_Buffer[0], pdu_len) <= 0 and BACnet_Debug_Enabled) {
+        fprintf(stderr, "Failed to send SubscribeCOVProperty request to device %u\n", device_id);
+    }
+    return invoke_id;
+}
+
+/* SubscribeCOVProperty on the present value when the point has an increment */
+static uint8_t send_point_subscription(point_id point, bool cancel, uint32_t process_id = subscriber_id)
+{
+    const auto& info = points.info(point);
+    BACNET_SUBSCRIBE_COV_DATA cov_data = {
+        .subscriberProcessIdentifier = process_id,
+        .monitoredObjectIdentifier = info.object,
+        .cancellationRequest = cancel,
+        .issueConfirmedNotifications = cov_confirmed,
+        .lifetime = cancel ? 0 : cov_lifetime
+    };
+    if (points.cov_increment[point] <= 0) {
+        return Send_COV_Subscribe(info.device_id, &cov_data);
+    }
+    cov_data.monitoredProperty = {.propertyIdentifier = PROP_PRESENT_VALUE, .propertyArrayIndex = BACNET_ARRAY_ALL};
+    cov_data.covIncrementPresent = not cancel;
+    cov_data.covIncrement = points.cov_increment[point];
+    return send_cov_subscribe_property(info.device_id, &cov_data);
+}
+
+paced_awaitable<request_reply> bacnet_subscribe_cov(point_id point, bool cancel)
+{
+    return paced_awaitable<request_reply>(
+        pacer,
+        points.info(point).device_id,
+        [point, cancel] {
+            return send_point_subscription(point, cancel);
+        },
+        [](uint8_t invoke_id, request_reply& reply) {
+            awaited_requests[invoke_id] = {.reply = &reply, .property = nullptr};
+        }
+    );
+}
+
+static request_task subscribe_point(point_id point)
+{
+    auto reply = co_await bacnet_subscribe_cov(point, false);
+    cov_subscribed(point, reply);
+}
+
+static void send_cov_subscribe(point_id point)
+{
+    uint8_t flags = points.flags[point];
+    if ((flags & (POINT_SUBSCRIBE_PENDING | POINT_EXCLUDED)) or shutting_down) {
+        return;
+    }
+    if ((flags & POINT_POLLED) and not (flags & POINT_COV_RETRY)) {
+        return;
+    }
+    points.flags[point] |= POINT_SUBSCRIBE_PENDING;
     if (BACnet_Debug_Enabled) {
-        fprintf(stderr, "Reading object list from device %u\n", device_id);
+        const auto& info = points.info(point);
+        fprintf(
+            stderr,
+            "Queueing COV subscribe to: %d, type: %s, instance %d\n",
+            info.device_id,
+            bactext_object_type_name(info.object.type),
+            info.object.instance
+        );
     }
-    auto invoke_id = Send_Read_Property_Request(
-        device_id,
-        OBJECT_DEVICE,
+    subscribe_point(point);
+}
+
+static void send_cov_cancel(point_id point)
+{
+    pacer.submit({
+        .device_id = points.info(point).device_id,
+        .send = [point] {
+            return send_point_subscription(point, true);
+        },
+        .done = [point](request_result result) {
+            if (result != request_result::ack and BACnet_Debug_Enabled) {
+                fprintf(stderr, "Unable to cancel the COV subscription of %s: %s\n",
+                    points.info(point).topic.c_str(), request_result_name(result));
+            }
+        }
+    });
+}
+
+/* updates POINT_EXCLUDED from the point selection, returns whether the
+ * point is selected */
+static bool select_point(point_id point)
+{
+    const auto& info = points.info(point);
+    if (point_filter.selected(info.device_id, info.object)) {
+        points.flags[point] &= ~POINT_EXCLUDED;
+        /* a changed increment applies from the next renewal */
+        points.cov_increment[point] = point_filter.cov_increment(info.device_id, info.object);
+        return true;
+    }
+    points.flags[point] |= POINT_EXCLUDED;
+    return false;
+}
+
+static void read_object_list_batch(uint32_t device_id);
+static void device_map_add(uint32_t device_id);
+
+/* silent devices get a targeted Who-Is, with exponential backoff, and are
+ * offline after device_offline_attempts of them went unanswered */
+static std::chrono::seconds device_stale_after{300};
+static const unsigned device_offline_attempts = 4;
+static const std::chrono::seconds who_is_backoff_min{5};
+static const std::chrono::seconds who_is_backoff_max{600};
+/* the I-Am of an online device checks its Database_Revision at most this often */
+static std::chrono::seconds revision_check_interval{3600};
+/* global Who-Is for devices which did not announce themselves */
+static std::chrono::seconds who_is_interval{600};
+static DeadlineQueue<uint32_t> liveness_queue;
+static device_state_handler device_state_handler_ = nullptr;
+static void *device_state_context_ = nullptr;
+
+static const char *device_state_name(device_state state)
+{
+    switch (state) {
+        case device_state::discovered: return "discovered";
+        case device_state::enumerating: return "enumerating";
+        case device_state::online: return "online";
+        case device_state::stale: return "stale";
+        case device_state::offline: return "offline";
+    }
+    return "unknown";
+}
+
+static void schedule_liveness_check(uint32_t device_id, device_entry& device, std::chrono::steady_clock::time_point at)
+{
+    device.check_at = at;
+    liveness_queue.schedule(device_id, at);
+}
+
+/* stops polling and renewals, the points are subscribed again once the
+ * object list of the returning device has been read */
+static void park_point(point_id point)
+{
+    stop_polling(point);
+    /* drops the queued renewal */
+    points.renew_at[point] = {};
+    points.subscribe_end[point] = {};
+}
+
+static void set_device_state(uint32_t device_id, device_entry& device, device_state state)
+{
+    if (device.state == state) {
+        return;
+    }
+    if (BACnet_Debug_Enabled) {
+        fprintf(stderr, "Device %u %s -> %s\n", device_id, device_state_name(device.state), device_state_name(state));
+    }
+    device.state = state;
+    if (state == device_state::stale) {
+        device.who_is_attempts = 0;
+    } else if (state == device_state::online) {
+        schedule_liveness_check(device_id, device, std::chrono::steady_clock::now() + device_stale_after);
+        if (not device.announced) {
+            device.announced = true;
+            fprintf(stderr, "Device %u is online\n", device_id);
+            if (device_state_handler_) {
+                device_state_handler_(device_state_context_, device_id, true);
+            }
+        }
+    } else if (state == device_state::offline) {
+        for (point_id point: device.points) {
+            park_point(point);
+        }
+        if (device.announced) {
+            device.announced = false;
+            fprintf(stderr, "Device %u is offline\n", device_id);
+            if (device_state_handler_) {
+                device_state_handler_(device_state_context_, device_id, false);
+            }
+        }
+    }
+}
+
+/* I-Am, replies and COV notifications all prove the device is alive */
+static void device_seen(uint32_t device_id)
+{
+    auto device_it = device_map.find(device_id);
+    if (device_it == device_map.end()) {
+        return;
+    }
+    auto& device = device_it->second;
+    device.last_seen = std::chrono::steady_clock::now();
+    if (device.state == device_state::stale and not device.cached) {
+        /* a cached device is confirmed by its database revision instead */
+        set_device_state(device_id, device, device_state::online);
+    } else if (device.state == device_state::offline) {
+        /* it may have been replaced or reprogrammed meanwhile */
+        fprintf(stderr, "Device %u is back, rediscovering\n", device_id);
+        device.cached = false;
+        device.object_count = 0;
+        set_device_state(device_id, device, device_state::discovered);
+        device_map_add(device_id);
+    }
+}
+
+/* unicast while the address binding is trusted, limited to the device
+ * instance on the broadcast network once it is offline */
+static void send_targeted_who_is(uint32_t device_id, const device_entry& device)
+{
+    BACNET_ADDRESS dest;
+    unsigned max_apdu = 0;
+    if (device.state == device_state::offline or not address_get_by_device(device_id, &max_apdu, &dest)) {
+        dest = {
+            .mac_len = 0,
+            .net = BACNET_BROADCAST_NETWORK,
+            .len = 0
+        };
+    }
+    if (BACnet_Debug_Enabled) {
+        fprintf(stderr, "Sending Who-Is Request to device %u\n", device_id);
+    }
+    Send_WhoIs_To_Network(&dest, device_id, device_id);
+}
+
+static void check_devices()
+{
+    auto now = std::chrono::steady_clock::now();
+    liveness_queue.pop_due(now, [now](uint32_t device_id, std::chrono::steady_clock::time_point deadline) {
+        auto& device = device_map[device_id];
+        if (deadline != device.check_at) {
+            return;
+        }
+        if (device.state == device_state::online) {
+            if (now - device.last_seen < device_stale_after) {
+                schedule_liveness_check(device_id, device, device.last_seen + device_stale_after);
+                return;
+            }
+            set_device_state(device_id, device, device_state::stale);
+        } else if (device.state == device_state::stale) {
+            if (device.who_is_attempts >= device_offline_attempts) {
+                set_device_state(device_id, device, device_state::offline);
+            }
+        } else if (device.state != device_state::offline) {
+            /* discovery in progress or stalled, the next I-Am resumes it */
+            return;
+        }
+        send_targeted_who_is(device_id, device);
+        device.who_is_attempts++;
+        unsigned doublings = std::min(device.who_is_attempts - 1, 10u);
+        schedule_liveness_check(device_id, device, now + std::min(who_is_backoff_min * (1 << doublings), who_is_backoff_max));
+    });
+}
+
+/* snapshot of device_map and the point table for warm restarts */
+static std::string snapshot_path;
+static bool registry_dirty = false;
+
+paced_awaitable<property_reply> bacnet_read_property(
+    uint32_t device_id, BACNET_OBJECT_ID object, BACNET_PROPERTY_ID property, uint32_t array_index)
+{
+    return paced_awaitable<property_reply>(
+        pacer,
         device_id,
-        PROP_OBJECT_LIST,
-        BACNET_ARRAY_ALL
+        [=] {
+            return Send_Read_Property_Request(device_id, object.type, object.instance, property, array_index);
+        },
+        [](uint8_t invoke_id, property_reply& reply) {
+            awaited_requests[invoke_id] = {.reply = &reply, .property = &reply};
+        }
     );
-    if (invoke_id == 0) {
-        fprintf(stderr, "Failed to read object list from device %u\n", device_id);
+}
+
+/* a cached device is trusted until its database revision says otherwise */
+static void handle_database_revision(uint32_t device_id, uint32_t database_revision)
+{
+    auto& device = device_map[device_id];
+    device.revision_checked = std::chrono::steady_clock::now();
+    if (device.cached) {
+        device.cached = false;
+        if (device.database_revision == database_revision) {
+            if (BACnet_Debug_Enabled) {
+                fprintf(stderr, "Cached object list of device %u is up to date\n", device_id);
+            }
+            set_device_state(device_id, device, device_state::online);
+            return;
+        }
+        fprintf(stderr, "Database revision of device %u changed, rediscovering\n", device_id);
+        device.object_count = 0;
+        device.database_revision = database_revision;
+        set_device_state(device_id, device, device_state::discovered);
+        device_map_add(device_id);
+        return;
+    }
+    if (device.database_revision != database_revision) {
+        bool changed = device.revision_known and device.state == device_state::online;
+        device.database_revision = database_revision;
+        registry_dirty = true;
+        if (changed) {
+            fprintf(stderr, "Database revision of device %u changed, rediscovering\n", device_id);
+            device.object_count = 0;
+            set_device_state(device_id, device, device_state::discovered);
+            device_map_add(device_id);
+        }
+    }
+    device.revision_known = true;
+}
+
+static request_task read_database_revision(uint32_t device_id)
+{
+    auto reply = co_await bacnet_read_property(device_id, {.type = OBJECT_DEVICE, .instance = device_id}, PROP_DATABASE_REVISION);
+    if (reply.result != request_result::ack or reply.value.tag != BACNET_APPLICATION_TAG_UNSIGNED_INT) {
+        if (BACnet_Debug_Enabled) {
+            fprintf(stderr, "Unable to read database revision of device %u\n", device_id);
+        }
+        co_return;
+    }
+    handle_database_revision(device_id, static_cast<uint32_t>(reply.value.type.Unsigned_Int));
+}
+
+static void save_registry()
+{
+    registry_snapshot snapshot;
+    snapshot.subscriber_id = subscriber_id;
+    for (const auto& [device_id, device]: device_map) {
+        snapshot_device record = {.device_id = device_id, .database_revision = device.database_revision};
+        bool complete = device.object_count != 0 and device.next_index > device.object_count;
+        if (not complete or not address_get_by_device(device_id, &record.max_apdu, &record.address)) {
+            continue;
+        }
+        record.object_list.reserve(device.points.size());
+        for (point_id point: device.points) {
+            record.object_list.push_back(points.info(point).object);
+        }
+        snapshot.devices.push_back(std::move(record));
+    }
+    snapshot.points.reserve(points.size());
+    for (point_id point = 0; point < points.size(); point++) {
+        const auto& info = points.info(point);
+        snapshot.points.push_back({.device_id = info.device_id, .object = info.object, .tag = points.tag[point]});
+    }
+    if (snapshot_save(snapshot_path, snapshot) and BACnet_Debug_Enabled) {
+        fprintf(stderr, "Saved snapshot with %zu devices and %zu points\n", snapshot.devices.size(), snapshot.points.size());
+    }
+}
+
+/* a random identifier for a new snapshot, so bridges sharing a device
+ * without BACNET_SUBSCRIBER_ID do not take over each other's subscriptions */
+static void choose_subscriber_id()
+{
+    if (subscriber_id != 0) {
+        return;
+    }
+    if (snapshot_path.empty()) {
+        subscriber_id = 1;
+        return;
+    }
+    subscriber_id = std::uniform_int_distribution<uint32_t>(1, BACNET_MAX_INSTANCE)(renewal_rng);
+    registry_dirty = true;
+}
+
+/* binds the cached devices and subscribes to their points right away */
+static void load_registry()
+{
+    registry_snapshot snapshot;
+    if (not snapshot_load(snapshot_path, snapshot)) {
+        return;
+    }
+    if (subscriber_id == 0) {
+        subscriber_id = snapshot.subscriber_id;
+    }
+    for (auto& record: snapshot.devices) {
+        address_add(record.device_id, record.max_apdu, &record.address);
+        auto& device = device_map[record.device_id];
+        device.object_count = record.object_list.size();
+        device.next_index = device.object_count + 1;
+        device.points.clear();
+        for (const auto& object: record.object_list) {
+            device.points.push_back(points.intern(record.device_id, object));
+        }
+        device.database_revision = record.database_revision;
+        device.revision_known = true;
+        device.cached = true;
+        /* trusted once the database revision is confirmed, a targeted
+         * Who-Is follows if it does not answer */
+        device.state = device_state::stale;
+        schedule_liveness_check(record.device_id, device, std::chrono::steady_clock::now() + who_is_backoff_min);
+    }
+    for (const auto& record: snapshot.points) {
+        point_id point = points.intern(record.device_id, record.object);
+        points.tag[point] = static_cast<uint8_t>(record.tag);
+        if (select_point(point)) {
+            send_cov_subscribe(point);
+        }
+    }
+    for (const auto& record: snapshot.devices) {
+        read_database_revision(record.device_id);
+    }
+    fprintf(stderr, "Loaded snapshot with %zu devices and %zu points\n", snapshot.devices.size(), snapshot.points.size());
+}
+
+static void object_list_batch_done(uint32_t device_id, uint32_t first, request_result result)
+{
+    auto& device = device_map[device_id];
+    if (result == request_result::ack) {
+        if (device.next_index == first) {
+            /* the element itself came back as an error, skip it */
+            fprintf(stderr, "Unable to read object list index %u of device %u\n", first, device_id);
+            device.next_index++;
+        }
+        read_object_list_batch(device_id);
+        return;
+    }
+    if (device.discovery_rpm) {
+        /* smaller responses first, then plain ReadProperty */
+        if (result == request_result::abort and device.batch_size > 1) {
+            device.batch_size /= 2;
+        } else {
+            device.discovery_rpm = false;
+        }
+        read_object_list_batch(device_id);
+        return;
+    }
+    fprintf(stderr, "Failed to read object list from device %u at index %u\n", device_id, device.next_index);
+    set_device_state(device_id, device, device_state::discovered);
+}
+
+static void read_object_list_batch(uint32_t device_id)
+{
+    auto& device = device_map[device_id];
+    if (device.next_index > device.object_count) {
+        if (BACnet_Debug_Enabled) {
+            fprintf(stderr, "Object list of device %u complete, %u objects\n", device_id, device.object_count);
+        }
+        set_device_state(device_id, device, device_state::online);
+        registry_dirty = true;
+        read_database_revision(device_id);
+        return;
+    }
+    uint32_t first = device.next_index;
+    if (not device.discovery_rpm) {
+        pacer.submit({
+            .device_id = device_id,
+            .send = [device_id, first] {
+                return Send_Read_Property_Request(device_id, OBJECT_DEVICE, device_id, PROP_OBJECT_LIST, first);
+            },
+            .done = [device_id, first](request_result result) {
+                object_list_batch_done(device_id, first, result);
+            }
+        });
+        return;
+    }
+    uint32_t count = std::min(device.batch_size, device.object_count - first + 1);
+    pacer.submit({
+        .device_id = device_id,
+        .send = [device_id, first, count] {
+            std::vector<BACNET_PROPERTY_REFERENCE> properties(count);
+            for (uint32_t i = 0; i < count; i++) {
+                properties[i].propertyIdentifier = PROP_OBJECT_LIST;
+                properties[i].propertyArrayIndex = first + i;
+                properties[i].next = i + 1 < count ? &properties[i + 1] : nullptr;
+            }
+            BACNET_READ_ACCESS_DATA read_access_data = {
+                .object_type = OBJECT_DEVICE,
+                .object_instance = device_id,
+                .listOfProperties = properties.data(),
+                .next = nullptr
+            };
+            uint8_t pdu[MAX_PDU];
+            return Send_Read_Property_Multiple_Request(pdu, sizeof(pdu), device_id, &read_access_data);
+        },
+        .done = [device_id, first](request_result result) {
+            object_list_batch_done(device_id, first, result);
+        }
+    });
+}
+
+/* Reads the array length first and then the elements in batches which fit
+ * into the device's APDU, an interrupted discovery resumes where it stopped */
+static void device_map_add(uint32_t device_id)
+{
+    auto& device = device_map[device_id];
+    if (device.state == device_state::enumerating) {
         return;
     }
+    if (device.cached) {
+        /* revalidate instead of rediscovering */
+        read_database_revision(device_id);
+        return;
+    }
+    set_device_state(device_id, device, device_state::enumerating);
+    if (device.object_count != 0 and device.next_index <= device.object_count) {
+        if (BACnet_Debug_Enabled) {
+            fprintf(stderr, "Resuming object list of device %u at index %u\n", device_id, device.next_index);
+        }
+        read_object_list_batch(device_id);
+        return;
+    }
+    if (BACnet_Debug_Enabled) {
+        fprintf(stderr, "Reading object list from device %u\n", device_id);
+    }
+    unsigned max_apdu = 0;
+    BACNET_ADDRESS address;
+    if (not address_get_by_device(device_id, &max_apdu, &address) or max_apdu == 0) {
+        max_apdu = 50;
+    }
+    /* an object identifier costs up to 14 bytes in a RPM ack */
+    device.batch_size = std::clamp((max_apdu - 16) / 14, 1u, 32u);
+    device.discovery_rpm = true;
+    pacer.submit({
+        .device_id = device_id,
+        .send = [device_id] {
+            return Send_Read_Property_Request(device_id, OBJECT_DEVICE, device_id, PROP_OBJECT_LIST, 0);
+        },
+        .done = [device_id](request_result result) {
+            if (result != request_result::ack) {
+                fprintf(stderr, "Failed to read object list length from device %u\n", device_id);
+                set_device_state(device_id, device_map[device_id], device_state::discovered);
+            }
+        }
+    });
     return;
 }
 
@@ -67,117 +790,417 @@ static void i_am_handler(uint8_t *service_request, uint16_t service_len, BACNET_
     uint32_t device_id;
     bool found = address_get_device_id(src, &device_id);
     if (found) {
-        device_map_add(device_id);
+        auto& device = device_map[device_id];
+        device_state previous = device.state;
+        device_seen(device_id);
+        auto now = std::chrono::steady_clock::now();
+        if (previous == device_state::discovered or device.cached) {
+            /* new, an interrupted discovery or cached in the snapshot */
+            device_map_add(device_id);
+        } else if (device.state == device_state::online and now - device.revision_checked >= revision_check_interval) {
+            /* the only thing that makes an online device enumerate again */
+            device.revision_checked = now;
+            read_database_revision(device_id);
+        }
     }
     return;
 }
 
-std::string application_data_value_to_string(const BACNET_APPLICATION_DATA_VALUE& value) {
-    switch (value.tag) {
-        case BACNET_APPLICATION_TAG_BOOLEAN:
-            return std::to_string(value.type.Boolean);
-        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
-            return std::to_string(value.type.Unsigned_Int);
-        case BACNET_APPLICATION_TAG_SIGNED_INT:
-            return std::to_string(value.type.Signed_Int);
-        case BACNET_APPLICATION_TAG_REAL:
-            return std::to_string(value.type.Real);
-        case BACNET_APPLICATION_TAG_DOUBLE:
-            return std::to_string(value.type.Double);
-        case BACNET_APPLICATION_TAG_OCTET_STRING:
-            return std::string(reinterpret_cast<const char*>(value.type.Octet_String.value), value.type.Octet_String.length);
-        case BACNET_APPLICATION_TAG_CHARACTER_STRING:
-            return std::string(value.type.Character_String.value, value.type.Character_String.length);
-        case BACNET_APPLICATION_TAG_BIT_STRING:
-            return std::string(reinterpret_cast<const char*>(value.type.Bit_String.value), value.type.Bit_String.bits_used);
-        case BACNET_APPLICATION_TAG_ENUMERATED:
-            return std::to_string(value.type.Enumerated);
-        default:
-            return "";
+/* reused by every notification, nothing is allocated on the publish path */
+static char value_buffer[value_buffer_size];
+
+/* cached values younger than this answer a read request, subscribed points
+ * are always current */
+static std::chrono::milliseconds cache_max_age{60000};
+static point_read_stats read_stats = {};
+
+/* stores the present value and status flags in the last value cache,
+ * returns whether a present value was among them */
+static bool cache_values(point_id point, BACNET_PROPERTY_VALUE *values)
+{
+    bool has_value = false;
+    for (auto *property_value = values; property_value != nullptr; property_value = property_value->next) {
+        if (
+            property_value->propertyIdentifier == PROP_STATUS_FLAGS and
+            property_value->value.tag == BACNET_APPLICATION_TAG_BIT_STRING
+        ) {
+            uint8_t status_flags = 0;
+            for (uint8_t bit = STATUS_FLAG_IN_ALARM; bit <= STATUS_FLAG_OUT_OF_SERVICE; bit++) {
+                status_flags |= bitstring_bit(&property_value->value.type.Bit_String, bit) << bit;
+            }
+            points.status_flags[point] = status_flags;
+        } else if (property_value->propertyIdentifier == PROP_PRESENT_VALUE) {
+            if (points.tag[point] != property_value->value.tag) {
+                points.tag[point] = property_value->value.tag;
+                registry_dirty = true;
+            }
+            size_t value_len = format_value(property_value->value, value_buffer, sizeof(value_buffer));
+            /* keeps its capacity, only grows for longer values */
+            points.value[point].assign(value_buffer, value_len);
+            points.flags[point] |= POINT_HAS_VALUE;
+            has_value = true;
+        }
     }
+    if (has_value) {
+        points.updated_at[point] = std::chrono::steady_clock::now();
+    }
+    return has_value;
 }
 
-static void ccov_notification_handle(BACNET_COV_DATA *cov_data)
+/* text publishes the present value alone, the structured formats the whole
+ * notification */
+static payload_format notification_format = payload_format::text;
+static char payload_buffer[payload_buffer_size];
+
+static std::string_view notification_payload(point_id point, const BACNET_COV_DATA& cov_data, int64_t timestamp_ms)
 {
-    auto cov_key = std::make_pair(cov_data->initiatingDeviceIdentifier, cov_data->monitoredObjectIdentifier);
-    auto subscribe_end = std::chrono::system_clock::now() + std::chrono::seconds(cov_data->timeRemaining);
-    cov_map[cov_key] = {.subscribe_end = subscribe_end};
-    for (auto *property_value = cov_data->listOfValues; property_value != nullptr; property_value = property_value->next) {
-        if (property_value->propertyIdentifier == PROP_PRESENT_VALUE) {
-            cov_map[cov_key] = {.subscribe_end = subscribe_end, .tag = property_value->value.tag};
-            if (ccov_notification_handler_) {
-                ccov_notification_handler_(
-                    cov_data->initiatingDeviceIdentifier,
-                    bactext_object_type_name(cov_data->monitoredObjectIdentifier.type),
-                    cov_data->monitoredObjectIdentifier.instance,
-                    application_data_value_to_string(property_value->value)
-                );
-            }
+    if (notification_format != payload_format::text) {
+        size_t payload_len = encode_notification(
+            notification_format, cov_data, timestamp_ms, payload_buffer, sizeof(payload_buffer));
+        if (payload_len > 0) {
+            return std::string_view(payload_buffer, payload_len);
         }
+        fprintf(stderr, "Notification too large for the payload buffer, publishing %s as text\n", points.info(point).topic.c_str());
     }
+    return points.value[point];
+}
 
+static int64_t system_time_ms(std::chrono::steady_clock::time_point time)
+{
+    auto age = std::chrono::steady_clock::now() - time;
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        (std::chrono::system_clock::now() - age).time_since_epoch()).count();
 }
 
-static void handle_object_list(uint32_t device_id, const BACNET_READ_PROPERTY_DATA& data) {
+/* caches the values of a notification or a resync read and hands them to
+ * the publisher */
+static void publish_values(point_id point, BACNET_COV_DATA *cov_data)
+{
+    if (cache_values(point, cov_data->listOfValues) and ccov_notification_handler_) {
+        ccov_notification_handler_(
+            ccov_notification_context_,
+            point,
+            points.info(point).topic,
+            notification_payload(point, *cov_data, system_time_ms(points.updated_at[point]))
+        );
+    }
+}
+
+/* a cancel only matches subscriptions for our own address, so this never
+ * touches another client's */
+static void send_orphan_cancel(point_id point, uint32_t process_id)
+{
+    uint64_t key = (static_cast<uint64_t>(point) << 32) | process_id;
+    if (not orphan_cancels.insert(key).second) {
+        return;
+    }
+    orphans_cancelled++;
     if (BACnet_Debug_Enabled) {
-        fprintf(stderr, "Received object list from device %d\n", device_id);
+        fprintf(stderr, "Cancelling subscription of %s left by process %u\n", points.info(point).topic.c_str(), process_id);
     }
-    std::vector<BACNET_OBJECT_ID> object_list;
-    uint8_t *application_data = data.application_data;
-    int application_data_len = data.application_data_len;
-    for (;;) {
-        BACNET_APPLICATION_DATA_VALUE value;
-        int len = bacapp_decode_known_property(
-            application_data,
-            application_data_len,
-            &value,
-            data.object_type,
-            data.object_property
-        );
+    pacer.submit({
+        .device_id = points.info(point).device_id,
+        .send = [point, process_id] {
+            return send_point_subscription(point, true, process_id);
+        },
+        .done = [key](request_result) {
+            orphan_cancels.erase(key);
+        }
+    });
+}
 
-        if (len < 0) {
-            fprintf(stderr, "RP Ack: unable to decode! %s:%s\n",
-                bactext_object_type_name(data.object_type),
-                bactext_property_name(data.object_property)
-            );
-            break;
+static void ccov_notification_handle(BACNET_COV_DATA *cov_data)
+{
+    point_id point = points.find(cov_data->initiatingDeviceIdentifier, cov_data->monitoredObjectIdentifier);
+    if (point == invalid_point) {
+        /* left over from a previous run, it expires by itself */
+        return;
+    }
+    points.subscribe_end[point] = std::chrono::steady_clock::now() + std::chrono::seconds(cov_data->timeRemaining);
+    points.flags[point] &= ~POINT_AWAITING_NOTIFICATION;
+    points.notifications[point]++;
+    device_seen(cov_data->initiatingDeviceIdentifier);
+    publish_values(point, cov_data);
+}
+
+/* notifications received from the network, as opposed to polled values */
+static void cov_notification_received(BACNET_COV_DATA *cov_data)
+{
+    if (cov_data->subscriberProcessIdentifier != subscriber_id and not shutting_down) {
+        point_id point = points.find(cov_data->initiatingDeviceIdentifier, cov_data->monitoredObjectIdentifier);
+        if (point != invalid_point) {
+            send_orphan_cancel(point, cov_data->subscriberProcessIdentifier);
         }
-        object_list.push_back(value.type.Object_Id);
+    }
+    ccov_notification_handle(cov_data);
+}
 
-        if (len < application_data_len) {
-            application_data += len;
-            application_data_len -= len;
-        } else {
-            for (const auto& object_id: object_list) {
-                if (object_id.type == OBJECT_DEVICE)
-                    continue;
-                cov_map[std::make_pair(device_id, object_id)] = {.subscribe_end = std::chrono::time_point<std::chrono::system_clock>()};
-		auto cov_key = std::make_pair(device_id, object_id);
-                if (BACnet_Debug_Enabled) {
-                    fprintf(
-                        stderr,
-                        "Sending COV subscribe to: %d, type: %s, instance %d\n",
-                        cov_key.first,
-                        bactext_object_type_name(cov_key.second.type),
-                        cov_key.second.instance
-                    );
-                }
-                BACNET_SUBSCRIBE_COV_DATA cov_data = {
-                    .subscriberProcessIdentifier = cov_key.first,
-                    .monitoredObjectIdentifier = cov_key.second,
-                    .cancellationRequest = false,
-                    .issueConfirmedNotifications = true,
-                    .lifetime = 300
-                };
-                Send_COV_Subscribe(cov_key.first, &cov_data);
+/* the initial notification after a subscription went missing */
+static void send_resync_read(point_id point)
+{
+    if (points.flags[point] & POINT_RESYNC_PENDING) {
+        return;
+    }
+    points.flags[point] |= POINT_RESYNC_PENDING;
+    resync_reads++;
+    const auto& info = points.info(point);
+    pacer.submit({
+        .device_id = info.device_id,
+        .send = [point] {
+            const auto& info = points.info(point);
+            return Send_Read_Property_Request(
+                info.device_id, info.object.type, info.object.instance, PROP_PRESENT_VALUE, BACNET_ARRAY_ALL);
+        },
+        .done = [point](request_result) {
+            /* the ack handler has published already */
+            points.flags[point] &= ~POINT_RESYNC_PENDING;
+        }
+    });
+}
+
+static void check_resyncs()
+{
+    resync_queue.pop_due(std::chrono::steady_clock::now(), [](point_id point, auto) {
+        if (points.flags[point] & POINT_AWAITING_NOTIFICATION) {
+            points.flags[point] &= ~POINT_AWAITING_NOTIFICATION;
+            send_resync_read(point);
+        }
+    });
+}
+
+/* publishes the present value read by a resync when it differs from the
+ * cache, i.e. a notification was lost */
+static void handle_resync_value(point_id point, BACNET_PROPERTY_VALUE *value)
+{
+    size_t value_len = format_value(value->value, value_buffer, sizeof(value_buffer));
+    bool changed = not (points.flags[point] & POINT_HAS_VALUE) or points.value[point] != std::string_view(value_buffer, value_len);
+    if (not changed) {
+        cache_values(point, value);
+        return;
+    }
+    const auto& info = points.info(point);
+    auto remaining = std::chrono::duration_cast<std::chrono::seconds>(points.subscribe_end[point] - std::chrono::steady_clock::now());
+    BACNET_COV_DATA cov_data = {
+        .subscriberProcessIdentifier = 0,
+        .initiatingDeviceIdentifier = info.device_id,
+        .monitoredObjectIdentifier = info.object,
+        .timeRemaining = static_cast<uint32_t>(std::max<int64_t>(remaining.count(), 0)),
+        .listOfValues = value
+    };
+    publish_values(point, &cov_data);
+}
+
+static void answer_read(point_id point)
+{
+    if (not read_handler_) {
+        return;
+    }
+    if (notification_format == payload_format::text) {
+        read_handler_(read_context_, point, points.info(point).topic, points.value[point]);
+        return;
+    }
+    /* rebuilt from the cache: present value and status flags */
+    const auto& info = points.info(point);
+    BACNET_PROPERTY_VALUE values[2] = {};
+    values[0].propertyIdentifier = PROP_PRESENT_VALUE;
+    values[0].propertyArrayIndex = BACNET_ARRAY_ALL;
+    if (not bacapp_parse_application_data(
+            static_cast<BACNET_APPLICATION_TAG>(points.tag[point]), points.value[point].c_str(), &values[0].value)) {
+        values[0].value.tag = BACNET_APPLICATION_TAG_NULL;
+    }
+    values[0].next = &values[1];
+    values[1].propertyIdentifier = PROP_STATUS_FLAGS;
+    values[1].propertyArrayIndex = BACNET_ARRAY_ALL;
+    values[1].value.tag = BACNET_APPLICATION_TAG_BIT_STRING;
+    bitstring_init(&values[1].value.type.Bit_String);
+    for (uint8_t bit = STATUS_FLAG_IN_ALARM; bit <= STATUS_FLAG_OUT_OF_SERVICE; bit++) {
+        bitstring_set_bit(&values[1].value.type.Bit_String, bit, points.status_flags[point] & (1 << bit));
+    }
+    auto remaining = std::chrono::duration_cast<std::chrono::seconds>(points.subscribe_end[point] - std::chrono::steady_clock::now());
+    BACNET_COV_DATA cov_data = {
+        .subscriberProcessIdentifier = 0,
+        .initiatingDeviceIdentifier = info.device_id,
+        .monitoredObjectIdentifier = info.object,
+        .timeRemaining = static_cast<uint32_t>(std::max<int64_t>(remaining.count(), 0)),
+        .listOfValues = values
+    };
+    read_handler_(read_context_, point, info.topic, notification_payload(point, cov_data, system_time_ms(points.updated_at[point])));
+}
+
+static void start_polling(point_id point)
+{
+    if (points.flags[point] & POINT_EXCLUDED) {
+        return;
+    }
+    const auto& info = points.info(point);
+    if (BACnet_Debug_Enabled) {
+        fprintf(
+            stderr,
+            "Polling device: %d, type: %s, instance %d\n",
+            info.device_id,
+            bactext_object_type_name(info.object.type),
+            info.object.instance
+        );
+    }
+    points.flags[point] |= POINT_POLLED;
+    poller.add(info.device_id, info.object);
+    unsigned max_apdu = 0;
+    BACNET_ADDRESS address;
+    if (not address_get_by_device(info.device_id, &max_apdu, &address) or max_apdu == 0) {
+        max_apdu = 50;
+    }
+    /* present value and status flags cost up to 32 bytes per object in a RPM ack */
+    unsigned batch_size = not device_map[info.device_id].rpm_poll_unsupported ? std::clamp((max_apdu - 16) / 32, 1u, 16u) : 1u;
+    if (poller.batch_size(info.device_id) == 1) {
+        poller.set_batch_size(info.device_id, batch_size);
+    }
+}
+
+static void poll_done(uint32_t device_id, const std::vector<BACNET_OBJECT_ID>& objects, bool rpm, request_result result)
+{
+    if (result == request_result::abort and objects.size() > 1) {
+        poller.set_batch_size(device_id, objects.size() / 2);
+    } else if (rpm and (result == request_result::reject or result == request_result::error)) {
+        /* also with a single object, the batch size is 1 for small APDUs */
+        device_map[device_id].rpm_poll_unsupported = true;
+        poller.set_batch_size(device_id, 1);
+    }
+    /* clears whatever was not answered */
+    poller.failed(device_id, objects);
+}
+
+static bool send_poll(uint32_t device_id, const std::vector<BACNET_OBJECT_ID>& objects)
+{
+    if (objects.size() == 1 and device_map[device_id].rpm_poll_unsupported) {
+        BACNET_OBJECT_ID object = objects.front();
+        pacer.submit({
+            .device_id = device_id,
+            .send = [device_id, object] {
+                return Send_Read_Property_Request(device_id, object.type, object.instance, PROP_PRESENT_VALUE, BACNET_ARRAY_ALL);
+            },
+            .done = [device_id, objects](request_result result) {
+                poll_done(device_id, objects, false, result);
             }
-            device_map[device_id] = {.object_list = std::move(object_list)};
-            if (BACnet_Debug_Enabled) {
-                fprintf(stderr, "Adding new device entry for device %d\n", device_id);
+        });
+        return true;
+    }
+    pacer.submit({
+        .device_id = device_id,
+        .send = [device_id, objects] {
+            std::vector<BACNET_READ_ACCESS_DATA> read_access_data(objects.size());
+            std::vector<BACNET_PROPERTY_REFERENCE> properties(objects.size() * 2);
+            for (size_t i = 0; i < objects.size(); i++) {
+                properties[2 * i] = {.propertyIdentifier = PROP_PRESENT_VALUE, .propertyArrayIndex = BACNET_ARRAY_ALL, .next = &properties[2 * i + 1]};
+                properties[2 * i + 1] = {.propertyIdentifier = PROP_STATUS_FLAGS, .propertyArrayIndex = BACNET_ARRAY_ALL, .next = nullptr};
+                read_access_data[i] = {
+                    .object_type = objects[i].type,
+                    .object_instance = objects[i].instance,
+                    .listOfProperties = &properties[2 * i],
+                    .next = i + 1 < objects.size() ? &read_access_data[i + 1] : nullptr
+                };
             }
-            break;
+            uint8_t pdu[MAX_PDU];
+            return Send_Read_Property_Multiple_Request(pdu, sizeof(pdu), device_id, read_access_data.data());
+        },
+        .done = [device_id, objects](request_result result) {
+            poll_done(device_id, objects, true, result);
         }
+    });
+    return true;
+}
+
+/* feeds a polled value into the same path as a COV notification, but only
+ * when it changed */
+static void handle_polled_values(uint32_t device_id, const BACNET_OBJECT_ID& object, BACNET_PROPERTY_VALUE *values)
+{
+    point_id point = points.find(device_id, object);
+    if (point == invalid_point or not (points.flags[point] & POINT_POLLED)) {
+        return;
+    }
+    bool changed = false;
+    for (auto *value = values; value != nullptr; value = value->next) {
+        if (value->propertyIdentifier == PROP_PRESENT_VALUE) {
+            size_t value_len = format_value(value->value, value_buffer, sizeof(value_buffer));
+            uint64_t value_hash = std::hash<std::string_view>()(std::string_view(value_buffer, value_len)) ^ value->value.tag;
+            changed = not (points.flags[point] & POINT_HAS_VALUE) or points.value_hash[point] != value_hash;
+            points.value_hash[point] = value_hash;
+            points.flags[point] |= POINT_HAS_VALUE;
+        }
+    }
+    poller.polled(device_id, object, changed);
+    if (not changed) {
+        /* still current, refresh the cache timestamp and status flags */
+        cache_values(point, values);
+    } else {
+        BACNET_COV_DATA cov_data = {
+            .subscriberProcessIdentifier = 0,
+            .initiatingDeviceIdentifier = device_id,
+            .monitoredObjectIdentifier = object,
+            .timeRemaining = 0,
+            .listOfValues = values
+        };
+        ccov_notification_handle(&cov_data);
+    }
+}
+
+static void handle_object_list_length(uint32_t device_id, const BACNET_READ_PROPERTY_DATA& data) {
+    BACNET_APPLICATION_DATA_VALUE value;
+    int len = bacapp_decode_application_data(data.application_data, data.application_data_len, &value);
+    if (len <= 0 or value.tag != BACNET_APPLICATION_TAG_UNSIGNED_INT) {
+        fprintf(stderr, "RP Ack: unable to decode object list length of device %u\n", device_id);
+        return;
+    }
+    auto& device = device_map[device_id];
+    device.object_count = static_cast<uint32_t>(value.type.Unsigned_Int);
+    device.next_index = 1;
+    device.points.clear();
+    device.points.reserve(device.object_count);
+    if (BACnet_Debug_Enabled) {
+        fprintf(stderr, "Device %u has %u objects\n", device_id, device.object_count);
+    }
+    read_object_list_batch(device_id);
+}
+
+/* streams one object list element into device_map and subscribes to it */
+static void handle_object_list_element(uint32_t device_id, uint32_t index, const BACNET_OBJECT_ID& object_id) {
+    auto& device = device_map[device_id];
+    if (index != device.next_index) {
+        /* duplicate or out of order, e.g. a retried request */
+        return;
+    }
+    device.next_index++;
+    if (object_id.type == OBJECT_DEVICE) {
+        return;
     }
+    point_id point = points.intern(device_id, object_id);
+    device.points.push_back(point);
+    /* a re-enumeration leaves running subscriptions alone */
+    if (select_point(point) and points.subscribe_end[point] <= std::chrono::steady_clock::now()) {
+        send_cov_subscribe(point);
+    }
+}
+
+static void handle_object_list(uint32_t device_id, const BACNET_READ_PROPERTY_DATA& data) {
+    if (data.array_index == 0) {
+        handle_object_list_length(device_id, data);
+        return;
+    }
+    BACNET_APPLICATION_DATA_VALUE value;
+    int len = bacapp_decode_known_property(
+        data.application_data,
+        data.application_data_len,
+        &value,
+        data.object_type,
+        data.object_property
+    );
+    if (len < 0 or value.tag != BACNET_APPLICATION_TAG_OBJECT_ID) {
+        fprintf(stderr, "RP Ack: unable to decode! %s:%s\n",
+            bactext_object_type_name(data.object_type),
+            bactext_property_name(data.object_property)
+        );
+        return;
+    }
+    handle_object_list_element(device_id, data.array_index, value.type.Object_Id);
 }
 
 /** Handler for a ReadProperty ACK.
@@ -198,31 +1221,121 @@ static void read_property_ack_handler(
     BACNET_CONFIRMED_SERVICE_ACK_DATA *service_data
 )
 {
+    awaited_request awaited = take_awaited(service_data->invoke_id);
     BACNET_READ_PROPERTY_DATA data;
     int len = rp_ack_decode_service_request(service_request, service_len, &data);
     if (len < 0) {
         fprintf(stderr, "Read property response decode failed!\n");
+        if (awaited.property) {
+            awaited.property->value.tag = MAX_BACNET_APPLICATION_TAG;
+        }
+        pacer.complete(service_data->invoke_id, request_result::ack);
+        return;
+    }
+    if (awaited.property) {
+        /* only the awaiting request_task gets it */
+        if (bacapp_decode_application_data(data.application_data, data.application_data_len, &awaited.property->value) <= 0) {
+            awaited.property->value.tag = MAX_BACNET_APPLICATION_TAG;
+        }
+        pacer.complete(service_data->invoke_id, request_result::ack);
         return;
     }
 
     uint32_t device_id;
     bool found = address_get_device_id(src, &device_id);
-    if (not found)
-        return;
+    if (found and data.object_type != OBJECT_DEVICE and data.object_property == PROP_PRESENT_VALUE) {
+        BACNET_PROPERTY_VALUE value = {.propertyIdentifier = PROP_PRESENT_VALUE, .propertyArrayIndex = BACNET_ARRAY_ALL, .next = nullptr};
+        if (bacapp_decode_application_data(data.application_data, data.application_data_len, &value.value) > 0) {
+            BACNET_OBJECT_ID object = {.type = data.object_type, .instance = data.object_instance};
+            point_id point = points.find(device_id, object);
+            if (point != invalid_point and (points.flags[point] & POINT_RESYNC_PENDING)) {
+                handle_resync_value(point, &value);
+            }
+            if (point != invalid_point and (points.flags[point] & POINT_READ_PENDING)) {
+                cache_values(point, &value);
+                answer_read(point);
+            }
+            handle_polled_values(device_id, object, &value);
+        }
+    }
+    if (found and data.object_type == OBJECT_DEVICE) {
+        if (data.object_property == PROP_OBJECT_LIST) {
+            handle_object_list(device_id, data);
+        }
+    }
+    pacer.complete(service_data->invoke_id, request_result::ack);
+}
 
-    if (data.object_type == OBJECT_DEVICE and data.object_property == PROP_OBJECT_LIST)
-        handle_object_list(device_id, data);
+static void read_property_multiple_ack_handler(
+    uint8_t *service_request,
+    uint16_t service_len,
+    BACNET_ADDRESS *src,
+    BACNET_CONFIRMED_SERVICE_ACK_DATA *service_data
+)
+{
+    uint32_t device_id;
+    bool found = address_get_device_id(src, &device_id);
+    auto *rpm_data = static_cast<BACNET_READ_ACCESS_DATA *>(calloc(1, sizeof(BACNET_READ_ACCESS_DATA)));
+    int len = rpm_ack_decode_service_request(service_request, service_len, rpm_data);
+    if (len <= 0) {
+        fprintf(stderr, "Read property multiple response decode failed!\n");
+    }
+    for (auto *object = rpm_data; found and len > 0 and object != nullptr; object = object->next) {
+        if (object->object_type != OBJECT_DEVICE) {
+            /* polled present value and status flags */
+            BACNET_PROPERTY_VALUE values[2];
+            BACNET_PROPERTY_VALUE *list = nullptr;
+            size_t count = 0;
+            for (auto *property = object->listOfProperties; property != nullptr and count < 2; property = property->next) {
+                if (property->value == nullptr) {
+                    continue;
+                }
+                values[count] = {
+                    .propertyIdentifier = property->propertyIdentifier,
+                    .propertyArrayIndex = property->propertyArrayIndex,
+                    .value = *property->value,
+                    .next = list
+                };
+                values[count].value.next = nullptr;
+                list = &values[count++];
+            }
+            if (list) {
+                handle_polled_values(device_id, {.type = object->object_type, .instance = object->object_instance}, list);
+            }
+            continue;
+        }
+        for (auto *property = object->listOfProperties; property != nullptr; property = property->next) {
+            if (
+                property->propertyIdentifier == PROP_OBJECT_LIST and
+                property->value != nullptr and
+                property->value->tag == BACNET_APPLICATION_TAG_OBJECT_ID
+            ) {
+                handle_object_list_element(device_id, property->propertyArrayIndex, property->value->type.Object_Id);
+            }
+        }
+    }
+    while (rpm_data) {
+        rpm_data = rpm_data_free(rpm_data);
+    }
+    take_awaited(service_data->invoke_id);
+    pacer.complete(service_data->invoke_id, request_result::ack);
 }
 
 static void handler_subscribe_ccov_ack(
     BACNET_ADDRESS *src, uint8_t invoke_id)
 {
-    uint32_t device_id;
-    bool found = address_get_device_id(src, &device_id);
-    if (not found)
-        return;
+    if (BACnet_Debug_Enabled) {
+        fprintf(stderr, "SubscribeCOV Acknowledged from: %x\n", src->mac[0]);
+    }
+    take_awaited(invoke_id);
+    pacer.complete(invoke_id, request_result::ack);
+}
 
-    fprintf(stderr, "SubscribeCOV Acknowledged from: %x\n", src->mac[0]);
+static void write_property_ack_handler(
+    BACNET_ADDRESS *src, uint8_t invoke_id)
+{
+    take_awaited(invoke_id);
+    pacer.complete(invoke_id, request_result::ack);
 }
 
 static void MyErrorHandler(
@@ -239,6 +1352,37 @@ static void MyErrorHandler(
         bactext_error_class_name(static_cast<int>(error_class)),
         bactext_error_code_name(static_cast<int>(error_code))
     );
+    if (request_reply *reply = take_awaited(invoke_id).reply) {
+        reply->error_class = error_class;
+        reply->error_code = error_code;
+    }
+    pacer.complete(invoke_id, request_result::error);
+}
+
+/* WritePropertyMultiple-Error also names the first write which failed, the
+ * ones before it were applied */
+static void wpm_error_handler(
+    BACNET_ADDRESS *src,
+    uint8_t invoke_id,
+    uint8_t service_choice,
+    uint8_t *service_request,
+    uint16_t service_len
+)
+{
+    (void)service_choice;
+    BACNET_WRITE_PROPERTY_DATA wp_data = {};
+    BACNET_OBJECT_ID *failed_write = awaited_requests[invoke_id].failed_write;
+    if (wpm_error_ack_decode_apdu(service_request, service_len, &wp_data) > 0) {
+        if (failed_write) {
+            *failed_write = {.type = wp_data.object_type, .instance = wp_data.object_instance};
+        }
+    } else {
+        fprintf(stderr, "WritePropertyMultiple error decode failed!\n");
+        wp_data.error_class = ERROR_CLASS_SERVICES;
+        wp_data.error_code = ERROR_CODE_OTHER;
+    }
+    /* clears the entry */
+    MyErrorHandler(src, invoke_id, wp_data.error_class, wp_data.error_code);
 }
 
 static void MyAbortHandler(
@@ -248,11 +1392,11 @@ static void MyAbortHandler(
     bool server
 )
 {
-    /* FIXME: verify src and invoke id */
     (void)src;
-    (void)invoke_id;
     (void)server;
-    fprintf(stderr, "BACnet Abort: %s\n", bactext_abort_reason_name(abort_reason));
+    fprintf(stderr, "BACnet Abort (invoke id %d): %s\n", invoke_id, bactext_abort_reason_name(abort_reason));
+    take_awaited(invoke_id);
+    pacer.complete(invoke_id, request_result::abort);
 }
 
 static void MyRejectHandler(
@@ -261,20 +1405,25 @@ static void MyRejectHandler(
     uint8_t reject_reason
 )
 {
-    /* FIXME: verify src and invoke id */
     (void)src;
-    (void)invoke_id;
-    fprintf(stderr, "BACnet Reject: %s\n", bactext_reject_reason_name(reject_reason));
+    fprintf(stderr, "BACnet Reject (invoke id %d): %s\n", invoke_id, bactext_reject_reason_name(reject_reason));
+    take_awaited(invoke_id);
+    pacer.complete(invoke_id, request_result::reject);
 }
 
 void TsmTimeoutHandler(uint8_t invoke_id)
 {
     fprintf(stderr, "BACnet Timeout: %d\n", invoke_id);
+    /* the TSM keeps a timed out invoke id reserved until it is freed */
+    tsm_free_invoke_id(invoke_id);
+    take_awaited(invoke_id);
+    pacer.complete(invoke_id, request_result::timeout);
 }
 
 static void init_service_handlers(void)
 {
-    static BACNET_COV_NOTIFICATION ccov_cb = {.next = nullptr, .callback = ccov_notification_handle};
+    static BACNET_COV_NOTIFICATION ccov_cb = {.next = nullptr, .callback = cov_notification_received};
+    static BACNET_COV_NOTIFICATION ucov_cb = {.next = nullptr, .callback = cov_notification_received};
     Device_Init(NULL);
     /* Note: this applications doesn't need to handle who-is
        it is confusing for the user! */
@@ -287,62 +1436,450 @@ static void init_service_handlers(void)
     apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_I_AM, i_am_handler);
     apdu_set_confirmed_handler(SERVICE_CONFIRMED_COV_NOTIFICATION, handler_ccov_notification);
     handler_ccov_notification_add(&ccov_cb);
+    apdu_set_unconfirmed_handler(SERVICE_UNCONFIRMED_COV_NOTIFICATION, handler_ucov_notification);
+    handler_ucov_notification_add(&ucov_cb);
     /* handle the data coming back from confirmed requests */
     apdu_set_confirmed_ack_handler(SERVICE_CONFIRMED_READ_PROPERTY, read_property_ack_handler);
+    apdu_set_confirmed_ack_handler(SERVICE_CONFIRMED_READ_PROP_MULTIPLE, read_property_multiple_ack_handler);
     apdu_set_confirmed_simple_ack_handler(SERVICE_CONFIRMED_SUBSCRIBE_COV, handler_subscribe_ccov_ack);
+    apdu_set_confirmed_simple_ack_handler(SERVICE_CONFIRMED_SUBSCRIBE_COV_PROPERTY, handler_subscribe_ccov_ack);
+    apdu_set_confirmed_simple_ack_handler(SERVICE_CONFIRMED_WRITE_PROPERTY, write_property_ack_handler);
+    apdu_set_confirmed_simple_ack_handler(SERVICE_CONFIRMED_WRITE_PROP_MULTIPLE, write_property_ack_handler);
     /* handle any errors coming back */
     apdu_set_error_handler(SERVICE_CONFIRMED_READ_PROPERTY, MyErrorHandler);
+    apdu_set_error_handler(SERVICE_CONFIRMED_READ_PROP_MULTIPLE, MyErrorHandler);
     apdu_set_error_handler(SERVICE_CONFIRMED_SUBSCRIBE_COV, MyErrorHandler);
+    apdu_set_error_handler(SERVICE_CONFIRMED_SUBSCRIBE_COV_PROPERTY, MyErrorHandler);
+    apdu_set_error_handler(SERVICE_CONFIRMED_WRITE_PROPERTY, MyErrorHandler);
+    apdu_set_complex_error_handler(SERVICE_CONFIRMED_WRITE_PROP_MULTIPLE, wpm_error_handler);
     apdu_set_abort_handler(MyAbortHandler);
     apdu_set_reject_handler(MyRejectHandler);
     tsm_set_timeout_handler(TsmTimeoutHandler);
 }
 
+/* renews only the subscriptions that are due, O(due items) */
 void renew_subscriptions() {
-    std::unordered_set<uint32_t> handeled_devices;
-    for (const auto& [cov_key, cov_entry]: cov_map) {
-        if (handeled_devices.count(cov_key.first)) {
+    auto now = std::chrono::steady_clock::now();
+    renewal_queue.pop_due(now, [now](point_id point, std::chrono::steady_clock::time_point renew_at) {
+        if (points.renew_at[point] != renew_at) {
+            /* rescheduled in the meantime */
+            return;
+        }
+        renewal_lag = std::chrono::duration_cast<std::chrono::milliseconds>(now - renew_at);
+        send_cov_subscribe(point);
+    });
+}
+
+std::chrono::milliseconds bacnet_renewal_lag() {
+    auto now = std::chrono::steady_clock::now();
+    auto next = renewal_queue.next_deadline();
+    if (next and *next < now) {
+        return std::max(renewal_lag, std::chrono::duration_cast<std::chrono::milliseconds>(now - *next));
+    }
+    return renewal_lag;
+}
+
+/* writes wait this long for more writes to the same device */
+static std::chrono::milliseconds write_window{50};
+static uint8_t write_priority = BACNET_NO_PRIORITY;
+static write_result_handler write_result_handler_ = nullptr;
+static void *write_result_context_ = nullptr;
+static write_batch_stats write_stats = {};
+
+struct pending_write {
+    point_id point;
+    BACNET_APPLICATION_DATA_VALUE value;
+    uint8_t priority;
+    /* earlier writes to the point within the window, they get the result
+     * of this one */
+    uint32_t superseded;
+};
+/* writes collected per device during the window, one entry per point */
+static std::unordered_map<uint32_t, std::vector<pending_write>> pending_writes;
+static DeadlineQueue<uint32_t> write_flush_queue;
+
+static void send_writes(uint32_t device_id, std::vector<pending_write> writes);
+
+/* one result per write command, the superseded ones included */
+static void write_done(const pending_write& write, request_result result)
+{
+    for (uint32_t i = 0; i <= write.superseded; i++) {
+        if (result == request_result::ack) {
+            write_stats.succeeded++;
+        } else {
+            write_stats.failed++;
+        }
+        if (write_result_handler_) {
+            write_result_handler_(write_result_context_, write.point, result);
+        }
+    }
+}
+
+static void send_single_write(uint32_t device_id, pending_write write)
+{
+    write_stats.single_requests++;
+    pacer.submit({
+        .device_id = device_id,
+        .send = [device_id, write]() mutable {
+            const auto& object = points.info(write.point).object;
+            return Send_Write_Property_Request(
+                device_id,
+                object.type,
+                object.instance,
+                PROP_PRESENT_VALUE,
+                &write.value,
+                write.priority,
+                BACNET_ARRAY_ALL
+            );
+        },
+        .done = [write](request_result result) {
+            write_done(write, result);
+        }
+    });
+}
+
+static void write_batch_done(
+    uint32_t device_id, std::vector<pending_write> writes, request_result result, const BACNET_OBJECT_ID& failed_write)
+{
+    auto& device = device_map[device_id];
+    switch (result) {
+        case request_result::ack:
+        case request_result::timeout:
+            for (const auto& write: writes) {
+                write_done(write, result);
+            }
+            break;
+        case request_result::reject:
+            device.wpm_unsupported = true;
+            send_writes(device_id, std::move(writes));
+            break;
+        case request_result::abort:
+            /* most likely too long for the device */
+            device.write_batch_size = std::max<uint32_t>(writes.size() / 2, 1);
+            send_writes(device_id, std::move(writes));
+            break;
+        case request_result::error: {
+            /* the device applied the writes before the failed one and none
+             * after it, those are sent again */
+            auto failed = std::find_if(writes.begin(), writes.end(), [&failed_write](const pending_write& write) {
+                const auto& object = points.info(write.point).object;
+                return object.type == failed_write.type and object.instance == failed_write.instance;
+            });
+            if (failed == writes.end()) {
+                /* unknown which were applied, so none is repeated */
+                for (const auto& write: writes) {
+                    write_done(write, result);
+                }
+                break;
+            }
+            for (auto write = writes.begin(); write != failed; ++write) {
+                write_done(*write, request_result::ack);
+            }
+            write_done(*failed, result);
+            if (failed + 1 != writes.end()) {
+                send_writes(device_id, std::vector<pending_write>(failed + 1, writes.end()));
+            }
+            break;
+        }
+    }
+}
+
+static void send_writes(uint32_t device_id, std::vector<pending_write> writes)
+{
+    auto& device = device_map[device_id];
+    unsigned max_apdu = 0;
+    BACNET_ADDRESS address;
+    if (not address_get_by_device(device_id, &max_apdu, &address) or max_apdu == 0) {
+        max_apdu = 50;
+    }
+    /* object, property, priority and a short value take about 24 bytes */
+    size_t batch_size = device.write_batch_size ? device.write_batch_size : std::clamp((max_apdu - 16) / 24, 1u, 32u);
+    if (device.wpm_unsupported or batch_size == 1 or writes.size() == 1) {
+        for (const auto& write: writes) {
+            send_single_write(device_id, write);
+        }
+        return;
+    }
+    for (size_t first = 0; first < writes.size(); first += batch_size) {
+        std::vector<pending_write> batch(
+            writes.begin() + first, writes.begin() + std::min(writes.size(), first + batch_size));
+        if (batch.size() == 1) {
+            send_single_write(device_id, batch.front());
             continue;
         }
-        if (cov_entry.subscribe_end - std::chrono::minutes(1) <= std::chrono::system_clock::now()) {
-            if (BACnet_Debug_Enabled) {
-                fprintf(
-                    stderr,
-                    "Sending COV subscribe to: %d, type: %s, instance %d\n",
-                    cov_key.first,
-                    bactext_object_type_name(cov_key.second.type),
-                    cov_key.second.instance
-                );
+        write_stats.multiple_requests++;
+        auto failed_write = std::make_shared<BACNET_OBJECT_ID>(BACNET_OBJECT_ID{.type = MAX_BACNET_OBJECT_TYPE, .instance = 0});
+        pacer.submit({
+            .device_id = device_id,
+            .send = [device_id, batch] {
+                std::vector<BACNET_WRITE_ACCESS_DATA> write_access_data(batch.size());
+                std::vector<BACNET_PROPERTY_VALUE> values(batch.size());
+                for (size_t i = 0; i < batch.size(); i++) {
+                    const auto& object = points.info(batch[i].point).object;
+                    values[i] = {
+                        .propertyIdentifier = PROP_PRESENT_VALUE,
+                        .propertyArrayIndex = BACNET_ARRAY_ALL,
+                        .value = batch[i].value,
+                        .priority = batch[i].priority,
+                        .next = nullptr
+                    };
+                    write_access_data[i] = {
+                        .object_type = object.type,
+                        .object_instance = object.instance,
+                        .listOfProperties = &values[i],
+                        .next = i + 1 < batch.size() ? &write_access_data[i + 1] : nullptr
+                    };
+                }
+                uint8_t pdu[MAX_PDU];
+                return Send_Write_Property_Multiple_Request(pdu, sizeof(pdu), device_id, write_access_data.data());
+            },
+            .done = [device_id, batch, failed_write](request_result result) {
+                write_batch_done(device_id, batch, result, *failed_write);
+            },
+            .sent = [failed_write](uint8_t invoke_id) {
+                /* type MAX_BACNET_OBJECT_TYPE unless an error names it */
+                *failed_write = {.type = MAX_BACNET_OBJECT_TYPE, .instance = 0};
+                awaited_requests[invoke_id] = {.failed_write = failed_write.get()};
             }
-            BACNET_SUBSCRIBE_COV_DATA cov_data = {
-                .subscriberProcessIdentifier = cov_key.first,
-                .monitoredObjectIdentifier = cov_key.second,
-                .cancellationRequest = false,
-                .issueConfirmedNotifications = true,
-                .lifetime = 300
-            };
-            Send_COV_Subscribe(cov_key.first, &cov_data);
-            handeled_devices.insert(cov_key.first);
+        });
+    }
+}
+
+static void flush_writes()
+{
+    write_flush_queue.pop_due(std::chrono::steady_clock::now(), [](uint32_t device_id, std::chrono::steady_clock::time_point) {
+        auto writes_it = pending_writes.find(device_id);
+        if (writes_it == pending_writes.end()) {
+            return;
+        }
+        std::vector<pending_write> writes = std::move(writes_it->second);
+        pending_writes.erase(writes_it);
+        send_writes(device_id, std::move(writes));
+    });
+}
+
+static void write_property(const write_command& command) {
+    const char *type = bactext_object_type_name(command.object_type);
+    point_id point = points.find(command.device_id, {.type = command.object_type, .instance = command.instance});
+    if (point == invalid_point) {
+        fprintf(stderr, "Unknown property for id: %d, type: %s, instance: %d\n", command.device_id, type, command.instance);
+        return;
+    }
+    BACNET_APPLICATION_DATA_VALUE data_value = {};
+    if (
+        !bacapp_parse_application_data(
+            static_cast<BACNET_APPLICATION_TAG>(points.tag[point]),
+            command.value, &data_value)
+    ) {
+        fprintf(
+            stderr,
+            "Error: unable to parse the value %s, for id: %d, type: %s, instance: %d\n",
+            command.value,
+            command.device_id,
+            type,
+            command.instance
+        );
+        return;
+    }
+    write_stats.writes++;
+    pending_write write = {
+        .point = point,
+        .value = data_value,
+        .priority = command.priority ? command.priority : write_priority,
+        .superseded = 0
+    };
+    auto& writes = pending_writes[command.device_id];
+    for (auto& pending: writes) {
+        if (pending.point == point) {
+            /* only the last value within the window is written */
+            write.superseded = pending.superseded + 1;
+            pending = write;
+            write_stats.coalesced++;
+            return;
+        }
+    }
+    writes.push_back(write);
+    if (writes.size() == 1) {
+        write_flush_queue.schedule(command.device_id, std::chrono::steady_clock::now() + write_window);
+    }
+}
+
+static void read_point(const read_command& command) {
+    BACNET_OBJECT_ID object = {.type = command.object_type, .instance = command.instance};
+    point_id point = points.find(command.device_id, object);
+    if (point == invalid_point) {
+        fprintf(
+            stderr,
+            "Unknown point for id: %d, type: %s, instance: %d\n",
+            command.device_id,
+            bactext_object_type_name(command.object_type),
+            command.instance
+        );
+        return;
+    }
+    read_stats.requests++;
+    auto now = std::chrono::steady_clock::now();
+    uint8_t flags = points.flags[point];
+    bool subscribed = not (flags & (POINT_POLLED | POINT_SUBSCRIBE_PENDING)) and points.subscribe_end[point] > now;
+    if ((flags & POINT_HAS_VALUE) and (subscribed or now - points.updated_at[point] < cache_max_age)) {
+        read_stats.cache_hits++;
+        answer_read(point);
+        return;
+    }
+    if (flags & POINT_READ_PENDING) {
+        read_stats.collapsed++;
+        return;
+    }
+    points.flags[point] |= POINT_READ_PENDING;
+    read_stats.reads++;
+    pacer.submit({
+        .device_id = command.device_id,
+        .send = [command] {
+            return Send_Read_Property_Request(
+                command.device_id, command.object_type, command.instance, PROP_PRESENT_VALUE, BACNET_ARRAY_ALL);
+        },
+        .done = [point](request_result result) {
+            /* the ack handler has answered already */
+            points.flags[point] &= ~POINT_READ_PENDING;
+            if (result != request_result::ack) {
+                read_stats.failures++;
+            }
+        }
+    });
+}
+
+static void process_commands() {
+    while (auto command = write_queue.pop()) {
+        write_property(*command);
+    }
+    while (auto command = read_queue.pop()) {
+        read_point(*command);
+    }
+}
+
+/* datalink_receive() blocks, so it gets a thread of its own which only
+ * queues the frames; all stack processing stays on the reactor thread */
+static void receive_thread() {
+    BACNET_ADDRESS src = { 0 };
+    uint8_t pdu[MAX_MPDU];
+    for (;;) {
+        uint16_t pdu_len = datalink_receive(&src, pdu, MAX_MPDU, 1000);
+        if (pdu_len == 0) {
+            continue;
+        }
+        pdus_received.fetch_add(1, std::memory_order_relaxed);
+        {
+            std::unique_lock<std::mutex> lock(rx_mutex);
+            rx_space.wait(lock, [] { return rx_count < std::size(rx_queue); });
+            rx_packet& packet = rx_queue[(rx_head + rx_count) % std::size(rx_queue)];
+            packet.src = src;
+            packet.pdu_len = pdu_len;
+            memcpy(packet.pdu, pdu, pdu_len);
+            rx_count++;
         }
+        uint64_t event = 1;
+        (void)!write(rx_event_fd, &event, sizeof(event));
     }
 }
 
-void bacnet_init(ccov_notification_handler handler) {
-    /* check for local environment settings */
+static void read_environment() {
     if (getenv("BACNET_DEBUG")) {
         BACnet_Debug_Enabled = true;
     }
+    const char *write_queue_policy = getenv("BACNET_WRITE_QUEUE_POLICY");
+    if (write_queue_policy and strcmp(write_queue_policy, "drop-oldest") == 0) {
+        write_queue.set_policy(overflow_policy::drop_oldest);
+    }
+    const char *max_in_flight = getenv("BACNET_MAX_IN_FLIGHT");
+    const char *max_per_device = getenv("BACNET_MAX_IN_FLIGHT_PER_DEVICE");
+    const char *max_attempts = getenv("BACNET_REQUEST_ATTEMPTS");
+    pacer.configure(
+        max_in_flight ? std::stoul(max_in_flight) : 8,
+        max_per_device ? std::stoul(max_per_device) : 1,
+        max_attempts ? std::stoul(max_attempts) : 3
+    );
+    const char *window = getenv("BACNET_WRITE_WINDOW_MS");
+    if (window) {
+        write_window = std::chrono::milliseconds(std::stoul(window));
+    }
+    const char *priority = getenv("BACNET_WRITE_PRIORITY");
+    if (priority) {
+        write_priority = static_cast<uint8_t>(std::clamp(std::stoul(priority), 0ul, 16ul));
+    }
+    const char *payload = getenv("BACNET_PAYLOAD");
+    if (payload and not parse_payload_format(payload, notification_format)) {
+        fprintf(stderr, "Unknown BACNET_PAYLOAD %s, publishing text\n", payload);
+    }
+    const char *cov_mode = getenv("BACNET_COV_MODE");
+    if (cov_mode and strcmp(cov_mode, "unconfirmed") == 0) {
+        cov_confirmed = false;
+    } else if (cov_mode and strcmp(cov_mode, "confirmed") != 0) {
+        fprintf(stderr, "Unknown BACNET_COV_MODE %s, subscribing for confirmed notifications\n", cov_mode);
+    }
+    const char *cache_age = getenv("BACNET_CACHE_MAX_AGE_MS");
+    if (cache_age) {
+        cache_max_age = std::chrono::milliseconds(std::stoul(cache_age));
+    }
+    const char *poll_min = getenv("BACNET_POLL_MIN_MS");
+    const char *poll_max = getenv("BACNET_POLL_MAX_MS");
+    poller.configure(
+        std::chrono::milliseconds(poll_min ? std::stoul(poll_min) : 5000),
+        std::chrono::milliseconds(poll_max ? std::stoul(poll_max) : 60000)
+    );
+    const char *stale_after = getenv("BACNET_DEVICE_STALE_S");
+    if (stale_after) {
+        device_stale_after = std::chrono::seconds(std::stoul(stale_after));
+    }
+    const char *revision_check = getenv("BACNET_REVISION_CHECK_S");
+    if (revision_check) {
+        revision_check_interval = std::chrono::seconds(std::stoul(revision_check));
+    }
+    const char *who_is = getenv("BACNET_WHO_IS_INTERVAL_S");
+    if (who_is) {
+        who_is_interval = std::chrono::seconds(std::max(std::stoul(who_is), 1ul));
+    }
+    const char *process_id = getenv("BACNET_SUBSCRIBER_ID");
+    if (process_id) {
+        subscriber_id = static_cast<uint32_t>(std::stoul(process_id));
+    }
+    const char *selection = getenv("BACNET_POINTS");
+    if (selection) {
+        point_filter_path = selection;
+        if (not point_filter.load(point_filter_path)) {
+            exit(1);
+        }
+        fprintf(stderr, "Loaded %zu point selection rules from %s\n", point_filter.size(), selection);
+    }
+}
 
+void bacnet_init(ccov_notification_handler handler, void *context, const std::string& topic_prefix) {
+    read_environment();
+    pacer.on_reply(device_seen);
+    pacer.on_reused(clear_awaited);
     Device_Set_Object_Instance_Number(BACNET_MAX_INSTANCE);
     init_service_handlers();
     address_init();
+    const char *capture_file = getenv("BACNET_CAPTURE");
+    if (capture_file and capture.open(capture_file)) {
+        fprintf(stderr, "Capturing received PDUs to %s\n", capture_file);
+    }
     dlenv_init();
     atexit(datalink_cleanup);
-    mstimer_set(&subscription_timer, 5000);
-    mstimer_set(&who_is_timer, 10 * apdu_timeout() * apdu_retries());
+    rx_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    std::thread(receive_thread).detach();
+    mstimer_set(&who_is_timer, std::chrono::milliseconds(who_is_interval).count());
     mstimer_set(&datalink_timer, 1000);
     mstimer_set(&tsm_timer, 100);
+    mstimer_set(&snapshot_timer, 10000);
     ccov_notification_handler_ = handler;
+    ccov_notification_context_ = context;
+    points.set_topic_prefix(topic_prefix);
+    const char *snapshot_file = getenv("BACNET_SNAPSHOT");
+    if (snapshot_file) {
+        snapshot_path = snapshot_file;
+        load_registry();
+    }
+    choose_subscriber_id();
     BACNET_ADDRESS dest = {
         .mac_len = 0,
         .net = BACNET_BROADCAST_NETWORK,
@@ -354,29 +1891,93 @@ void bacnet_init(ccov_notification_handler handler) {
     Send_WhoIs_To_Network(&dest, -1, -1);
 }
 
-void bacnet_task() {
-    BACNET_ADDRESS src = { 0 };
-    unsigned delay_milliseconds = 100;
+int bacnet_fd() {
+    return rx_event_fd;
+}
 
-    /* returns 0 bytes on timeout */
-    uint16_t pdu_len = datalink_receive(&src, &Rx_Buf[0], MAX_MPDU, delay_milliseconds);
-    /* process */
-    if (pdu_len) {
+void bacnet_receive() {
+    uint64_t events;
+    (void)!read(rx_event_fd, &events, sizeof(events));
+    for (;;) {
+        BACNET_ADDRESS src;
+        uint16_t pdu_len;
+        {
+            std::lock_guard<std::mutex> lock(rx_mutex);
+            if (rx_count == 0) {
+                break;
+            }
+            const rx_packet& packet = rx_queue[rx_head];
+            src = packet.src;
+            pdu_len = packet.pdu_len;
+            memcpy(Rx_Buf, packet.pdu, pdu_len);
+            rx_head = (rx_head + 1) % std::size(rx_queue);
+            rx_count--;
+        }
+        rx_space.notify_one();
+        if (capture.is_open()) {
+            int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            capture.append(now, src, Rx_Buf, pdu_len);
+        }
         npdu_handler(&src, &Rx_Buf[0], pdu_len);
     }
-    if (mstimer_expired(&tsm_timer)) {
+    process_commands();
+}
+
+void bacnet_replay_init(ccov_notification_handler handler, void *context, const std::string& topic_prefix) {
+    read_environment();
+    pacer.on_reply(device_seen);
+    pacer.on_reused(clear_awaited);
+    Device_Set_Object_Instance_Number(BACNET_MAX_INSTANCE);
+    init_service_handlers();
+    address_init();
+    ccov_notification_handler_ = handler;
+    ccov_notification_context_ = context;
+    points.set_topic_prefix(topic_prefix);
+    const char *snapshot_file = getenv("BACNET_SNAPSHOT");
+    if (snapshot_file) {
+        snapshot_path = snapshot_file;
+        load_registry();
+    }
+    choose_subscriber_id();
+}
+
+void bacnet_replay_pdu(BACNET_ADDRESS *src, uint8_t *pdu, uint16_t pdu_len) {
+    npdu_handler(src, pdu, pdu_len);
+}
+
+static unsigned timer_remaining(struct mstimer *timer) {
+    return mstimer_expired(timer) ? 0 : mstimer_remaining(timer);
+}
+
+/* the TSM tick only runs while transactions are open, so an idle bridge
+ * does not wake up ten times a second */
+static bool tsm_ticking = false;
+
+unsigned bacnet_task() {
+    process_commands();
+    if (tsm_ticking and mstimer_expired(&tsm_timer)) {
         tsm_timer_milliseconds(mstimer_interval(&tsm_timer));
         mstimer_reset(&tsm_timer);
     }
     if (mstimer_expired(&datalink_timer)) {
         datalink_maintenance_timer(mstimer_interval(&datalink_timer) / 1000);
         mstimer_reset(&datalink_timer);
+        capture.flush();
     }
-    if (mstimer_expired(&subscription_timer)) {
-        mstimer_reset(&subscription_timer);
+    if (not shutting_down) {
         renew_subscriptions();
+        check_devices();
+        check_resyncs();
+    }
+    if (mstimer_expired(&snapshot_timer)) {
+        mstimer_reset(&snapshot_timer);
+        if (registry_dirty and not snapshot_path.empty()) {
+            registry_dirty = false;
+            save_registry();
+        }
     }
-    if (mstimer_expired(&who_is_timer)) {
+    if (mstimer_expired(&who_is_timer) and not shutting_down) {
         mstimer_reset(&who_is_timer);
         if (BACnet_Debug_Enabled) {
             fprintf(stderr, "Sending Who-Is Request\n");
@@ -388,42 +1989,271 @@ void bacnet_task() {
         };
         Send_WhoIs_To_Network(&dest, -1, -1);
     }
+    flush_writes();
+    /* polls are submitted before the pacer sends */
+    long poll_remaining = shutting_down ? -1 : poller.task(send_poll);
+    long pacer_remaining = pacer.task();
+    auto now = std::chrono::steady_clock::now();
+    unsigned remaining = std::min(timer_remaining(&datalink_timer), timer_remaining(&snapshot_timer));
+    if (tsm_transaction_idle_count() == MAX_TSM_TRANSACTIONS) {
+        tsm_ticking = false;
+    } else {
+        if (not tsm_ticking) {
+            /* a full interval from now, not the ticks missed while idle */
+            mstimer_restart(&tsm_timer);
+            tsm_ticking = true;
+        }
+        remaining = std::min(remaining, timer_remaining(&tsm_timer));
+    }
+    long write_remaining = write_flush_queue.remaining_ms(now);
+    if (shutting_down) {
+        /* only the cancels and queued writes are left */
+        long shutdown_remaining = std::max(0l, static_cast<long>(
+            std::chrono::ceil<std::chrono::milliseconds>(shutdown_deadline - now).count()));
+        for (long deadline: {pacer_remaining, write_remaining, shutdown_remaining}) {
+            if (deadline >= 0 and static_cast<unsigned long>(deadline) < remaining) {
+                remaining = static_cast<unsigned>(deadline);
+            }
+        }
+        return remaining;
+    }
+    remaining = std::min(remaining, timer_remaining(&who_is_timer));
+    long renewal_remaining = renewal_queue.remaining_ms(now);
+    long liveness_remaining = liveness_queue.remaining_ms(now);
+    long resync_remaining = resync_queue.remaining_ms(now);
+    for (long deadline: {pacer_remaining, poll_remaining, write_remaining, renewal_remaining, liveness_remaining, resync_remaining}) {
+        if (deadline >= 0 and static_cast<unsigned long>(deadline) < remaining) {
+            remaining = static_cast<unsigned>(deadline);
+        }
+    }
+    return remaining;
 }
 
-void bacnet_send(uint32_t id, const std::string& type, uint32_t instance, std::string value) {
-    unsigned type_int;
-    if (not bactext_object_type_strtol(type.c_str(), &type_int)) {
-        fprintf(stderr, "Unknown type for id: %d, type: %s, instance: %d\n", id, type.c_str(), instance);
-    }
-    auto cov_key = std::make_pair(id, BACNET_OBJECT_ID{.type = BACnetObjectType(type_int), .instance = instance});
-    auto cov_entry_it = cov_map.find(cov_key);
-    if (cov_entry_it == cov_map.end()) {
-        fprintf(stderr, "Unknown property for id: %d, type: %s, instance: %d\n", id, type.c_str(), instance);
+request_pacer_stats bacnet_pacer_stats() {
+    return pacer.stats();
+}
+
+void bacnet_shutdown(std::chrono::milliseconds budget) {
+    if (shutting_down) {
         return;
     }
-    BACNET_APPLICATION_DATA_VALUE data_value = {};
-    if (
-        !bacapp_parse_application_data(
-            static_cast<BACNET_APPLICATION_TAG>(cov_entry_it->second.tag),
-            const_cast<char *>(value.c_str()), &data_value)
-    ) {
-        fprintf(
-            stderr,
-            "Error: unable to parse the value %s, for id: %d, type: %s, instance: %d\n",
-            value.c_str(),
-            id,
-            type.c_str(),
-            instance
-        );
-        return;
+    auto now = std::chrono::steady_clock::now();
+    shutting_down = true;
+    shutdown_deadline = now + budget;
+    size_t cancelled = 0;
+    for (point_id point = 0; point < points.size(); point++) {
+        uint8_t flags = points.flags[point];
+        /* pending subscribes are cancelled when they are acked */
+        if (not (flags & (POINT_POLLED | POINT_SUBSCRIBE_PENDING)) and points.subscribe_end[point] > now) {
+            send_cov_cancel(point);
+            cancelled++;
+        }
+        points.renew_at[point] = {};
     }
-    Send_Write_Property_Request(
-        id,
-        BACnetObjectType(type_int),
-        instance,
-        PROP_PRESENT_VALUE,
-        &data_value,
-        0,
-        BACNET_ARRAY_ALL
-    );
+    if (registry_dirty and not snapshot_path.empty()) {
+        registry_dirty = false;
+        save_registry();
+    }
+    fprintf(stderr, "Shutting down, cancelling %zu COV subscriptions\n", cancelled);
+}
+
+bool bacnet_shutdown_complete() {
+    if (not shutting_down) {
+        return false;
+    }
+    if (pacer.idle()) {
+        return true;
+    }
+    if (std::chrono::steady_clock::now() >= shutdown_deadline) {
+        auto stats = pacer.stats();
+        fprintf(stderr, "Shutdown budget exhausted with %zu requests outstanding\n", stats.in_flight + stats.queued);
+        return true;
+    }
+    return false;
+}
+
+bool bacnet_reload_points() {
+    if (point_filter_path.empty()) {
+        return false;
+    }
+    PointFilter filter;
+    if (not filter.load(point_filter_path)) {
+        return false;
+    }
+    point_filter = std::move(filter);
+    size_t added = 0;
+    size_t removed = 0;
+    for (const auto& [device_id, device]: device_map) {
+        for (point_id point: device.points) {
+            bool was_selected = not (points.flags[point] & POINT_EXCLUDED);
+            bool selected = select_point(point);
+            if (selected and not was_selected) {
+                send_cov_subscribe(point);
+                added++;
+            } else if (was_selected and not selected) {
+                if (points.flags[point] & POINT_POLLED) {
+                    stop_polling(point);
+                } else if (not (points.flags[point] & POINT_SUBSCRIBE_PENDING)) {
+                    /* a pending subscribe is cancelled when it is acked */
+                    send_cov_cancel(point);
+                }
+                /* drops the queued renewal */
+                points.renew_at[point] = {};
+                points.subscribe_end[point] = {};
+                removed++;
+            }
+        }
+    }
+    fprintf(stderr, "Reloaded %zu point selection rules: %zu points added, %zu removed\n", point_filter.size(), added, removed);
+    return true;
+}
+
+void bacnet_metrics(MetricsReport& report) {
+    auto now = std::chrono::steady_clock::now();
+    report.add("bacnet_pdus_received_total", "PDUs received from the datalink", metric_type::counter,
+               pdus_received.load(std::memory_order_relaxed));
+    size_t polled = 0;
+    size_t subscribed = 0;
+    size_t excluded = 0;
+    size_t awaiting_slot = 0;
+    std::map<uint32_t, uint64_t> device_notifications;
+    for (point_id point = 0; point < points.size(); point++) {
+        polled += (points.flags[point] & POINT_POLLED) != 0;
+        awaiting_slot += (points.flags[point] & POINT_COV_RETRY) != 0;
+        excluded += (points.flags[point] & POINT_EXCLUDED) != 0;
+        subscribed += not (points.flags[point] & POINT_POLLED) and points.subscribe_end[point] > now;
+        device_notifications[points.info(point).device_id] += points.notifications[point];
+    }
+    report.add("bacnet_points", "Known points", metric_type::gauge, points.size());
+    report.add("bacnet_points_subscribed", "Points with an active COV subscription", metric_type::gauge, subscribed);
+    report.add("bacnet_points_polled", "Points polled because COV was refused", metric_type::gauge, polled);
+    report.add("bacnet_points_excluded", "Points left out by the point selection", metric_type::gauge, excluded);
+    report.add("bacnet_points_awaiting_cov_slot", "Polled points retrying COV once the device has a free slot",
+               metric_type::gauge, awaiting_slot);
+    report.add("bacnet_cov_slot_exhausted_total", "COV subscriptions refused for lack of resources",
+               metric_type::counter, cov_slot_exhausted);
+    report.add("bacnet_cov_orphans_cancelled_total", "Subscriptions of an earlier subscriber process identifier cancelled",
+               metric_type::counter, orphans_cancelled);
+    report.add("bacnet_cov_resync_reads_total", "Present value reads after a missing unconfirmed notification",
+               metric_type::counter, resync_reads);
+    for (const auto& [device_id, count]: device_notifications) {
+        report.add("bacnet_cov_notifications_total", "COV notifications and changed polled values",
+                   metric_type::counter, "device", std::to_string(device_id), count);
+    }
+    size_t device_states[5] = {};
+    for (const auto& [device_id, device]: device_map) {
+        device_states[static_cast<size_t>(device.state)]++;
+    }
+    for (size_t state = 0; state < std::size(device_states); state++) {
+        report.add("bacnet_devices", "Devices by lifecycle state", metric_type::gauge,
+                   "state", device_state_name(static_cast<device_state>(state)), device_states[state]);
+    }
+    auto stats = pacer.stats();
+    std::pair<const char *, uint64_t> results[] = {
+        {"ack", stats.acks},
+        {"error", stats.errors},
+        {"abort", stats.aborts},
+        {"reject", stats.rejects},
+        {"timeout", stats.timeouts}
+    };
+    report.add("bacnet_requests_sent_total", "Confirmed requests sent, retries included", metric_type::counter, stats.sent);
+    report.add("bacnet_requests_retried_total", "Confirmed requests retried", metric_type::counter, stats.retries);
+    report.add("bacnet_requests_failed_total", "Confirmed requests given up after retries", metric_type::counter, stats.failures);
+    for (const auto& [result, count]: results) {
+        report.add("bacnet_responses_total", "Responses to confirmed requests", metric_type::counter, "result", result, count);
+    }
+    report.add("bacnet_requests_in_flight", "Confirmed requests waiting for a response", metric_type::gauge, stats.in_flight);
+    report.add("bacnet_requests_queued", "Confirmed requests waiting to be sent", metric_type::gauge, stats.queued);
+    report.add("bacnet_invoke_ids_in_use", "TSM transactions in use", metric_type::gauge,
+               MAX_TSM_TRANSACTIONS - tsm_transaction_idle_count());
+    report.add("bacnet_renewal_lag_seconds", "How far the COV renewals are behind schedule", metric_type::gauge,
+               bacnet_renewal_lag().count() / 1000.0);
+    auto queue_stats = write_queue.stats();
+    report.add("bacnet_write_queue_depth", "Writes from MQTT waiting for the BACnet thread", metric_type::gauge, queue_stats.depth);
+    report.add("bacnet_write_queue_dropped_total", "Writes dropped or rejected by a full queue", metric_type::counter,
+               queue_stats.dropped + queue_stats.rejected);
+    report.add("bacnet_writes_total", "Writes requested over MQTT", metric_type::counter, write_stats.writes);
+    report.add("bacnet_writes_coalesced_total", "Writes superseded by a later one to the same point within the window",
+               metric_type::counter, write_stats.coalesced);
+    report.add("bacnet_write_requests_total", "Write requests sent, without retries", metric_type::counter,
+               "service", "write-property-multiple", write_stats.multiple_requests);
+    report.add("bacnet_write_requests_total", "Write requests sent, without retries", metric_type::counter,
+               "service", "write-property", write_stats.single_requests);
+    report.add("bacnet_write_results_total", "Outcome of each written point", metric_type::counter,
+               "result", "succeeded", write_stats.succeeded);
+    report.add("bacnet_write_results_total", "Outcome of each written point", metric_type::counter,
+               "result", "failed", write_stats.failed);
+    report.add("bacnet_reads_total", "On demand reads requested over MQTT", metric_type::counter, read_stats.requests);
+    report.add("bacnet_read_cache_hits_total", "On demand reads answered from the cache", metric_type::counter, read_stats.cache_hits);
+    report.add("bacnet_reads_collapsed_total", "On demand reads answered by a read already outstanding",
+               metric_type::counter, read_stats.collapsed);
+    report.add("bacnet_reads_sent_total", "ReadProperty requests sent for on demand reads", metric_type::counter, read_stats.reads);
+    report.add("bacnet_reads_failed_total", "On demand reads which failed after retries", metric_type::counter, read_stats.failures);
+}
+
+const PointTable& bacnet_points() {
+    return points;
+}
+
+bool bacnet_send(uint32_t id, BACNET_OBJECT_TYPE type, uint32_t instance, std::string_view value, uint8_t priority) {
+    write_command command = {
+        .device_id = id,
+        .object_type = type,
+        .instance = instance,
+        .priority = priority
+    };
+    if (value.size() >= sizeof(command.value)) {
+        fprintf(stderr, "Value too long for id: %d, type: %s, instance: %d\n", id, bactext_object_type_name(type), instance);
+        return false;
+    }
+    command.value_len = static_cast<uint8_t>(value.size());
+    memcpy(command.value, value.data(), value.size());
+    command.value[value.size()] = '\0';
+    if (not write_queue.push(command)) {
+        if (BACnet_Debug_Enabled) {
+            fprintf(stderr, "Write queue full, rejected write for id: %d, type: %s, instance: %d\n", id, bactext_object_type_name(type), instance);
+        }
+        return false;
+    }
+    /* wake the reactor in case we are called from another thread, on every
+     * push since the eventfd merges the signals */
+    uint64_t event = 1;
+    (void)!write(rx_event_fd, &event, sizeof(event));
+    return true;
+}
+
+bool bacnet_get(uint32_t id, BACNET_OBJECT_TYPE type, uint32_t instance) {
+    if (not read_queue.push({.device_id = id, .object_type = type, .instance = instance})) {
+        return false;
+    }
+    uint64_t event = 1;
+    (void)!write(rx_event_fd, &event, sizeof(event));
+    return true;
+}
+
+void bacnet_set_read_handler(ccov_notification_handler handler, void *context) {
+    read_handler_ = handler;
+    read_context_ = context;
+}
+
+point_read_stats bacnet_read_stats() {
+    return read_stats;
+}
+
+void bacnet_set_device_state_handler(device_state_handler handler, void *context) {
+    device_state_handler_ = handler;
+    device_state_context_ = context;
+}
+
+void bacnet_set_write_result_handler(write_result_handler handler, void *context) {
+    write_result_handler_ = handler;
+    write_result_context_ = context;
+}
+
+write_batch_stats bacnet_write_stats() {
+    return write_stats;
+}
+
+command_queue_stats bacnet_write_queue_stats() {
+    return write_queue.stats();
 }
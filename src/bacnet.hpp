@@ -11,6 +11,8 @@
 #include <bacnet/basic/object/device.h>
 #include <bacnet/datalink/datalink.h>
 #include <bacnet/bactext.h>
+#include <bacnet/cov.h>
+#include <bacnet/dcc.h>
 #include <bacnet/version.h>
 /* some demo stuff needed */
 #include <bacnet/basic/sys/mstimer.h>
@@ -18,13 +20,127 @@
 #include <bacnet/basic/services.h>
 #include <bacnet/basic/services.h>
 #include <bacnet/basic/tsm/tsm.h>
+#ifdef BACDL_MSTP
 #include <rs485.h>
+#endif
 #include <bacnet/datalink/dlenv.h>
 #include <bacport.h>
 #include <functional>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include "command_queue.hpp"
+#include "pacer.hpp"
+#include "point_table.hpp"
+#include "request_task.hpp"
+#include "metrics.hpp"
 
-typedef std::function<void(uint32_t, const std::string&, uint32_t, std::string)> ccov_notification_handler;
+/* called with the point, its precomputed MQTT topic and the formatted value,
+ * which lives in a buffer that is reused by the next notification */
+typedef void (*ccov_notification_handler)(void *context, point_id point, const std::string& topic, std::string_view value);
 
-void bacnet_init(ccov_notification_handler handler);
-void bacnet_task();
-void bacnet_send(uint32_t id, const std::string& type, uint32_t instance, std::string value);
+void bacnet_init(ccov_notification_handler handler, void *context, const std::string& topic_prefix);
+/* eventfd readable whenever received PDUs are waiting for bacnet_receive() */
+int bacnet_fd();
+void bacnet_receive();
+/* runs the expired stack timers, returns milliseconds until the next one */
+unsigned bacnet_task();
+/* Sets up the handlers and the point table like bacnet_init() but without a
+ * datalink, for feeding captured PDUs (BACNET_CAPTURE) back in. Requests and
+ * replies the handlers send go nowhere. BACNET_SNAPSHOT provides the devices
+ * and points of a trace that starts after discovery. */
+void bacnet_replay_init(ccov_notification_handler handler, void *context, const std::string& topic_prefix);
+void bacnet_replay_pdu(BACNET_ADDRESS *src, uint8_t *pdu, uint16_t pdu_len);
+/* a device finished discovery or came back (online true) or stopped
+ * answering its targeted Who-Is (online false), on the BACnet thread */
+typedef void (*device_state_handler)(void *context, uint32_t device_id, bool online);
+void bacnet_set_device_state_handler(device_state_handler handler, void *context);
+/* write request parsed on the MQTT side, applied by the BACnet thread */
+struct write_command {
+    uint32_t device_id;
+    BACNET_OBJECT_TYPE object_type;
+    uint32_t instance;
+    /* 1 .. 16, 0 for the configured default */
+    uint8_t priority;
+    uint8_t value_len;
+    char value[128];
+};
+
+/* thread safe, never blocks; returns false when the command was not queued */
+bool bacnet_send(uint32_t id, BACNET_OBJECT_TYPE type, uint32_t instance, std::string_view value, uint8_t priority = 0);
+/* outcome of every write, after batching and retries */
+typedef void (*write_result_handler)(void *context, point_id point, request_result result);
+void bacnet_set_write_result_handler(write_result_handler handler, void *context);
+
+struct write_batch_stats {
+    uint64_t writes;
+    /* superseded by a later write to the same point within the window */
+    uint64_t coalesced;
+    uint64_t multiple_requests;
+    uint64_t single_requests;
+    uint64_t succeeded;
+    uint64_t failed;
+};
+write_batch_stats bacnet_write_stats();
+/* on demand read of a point's present value */
+struct read_command {
+    uint32_t device_id;
+    BACNET_OBJECT_TYPE object_type;
+    uint32_t instance;
+};
+
+struct point_read_stats {
+    uint64_t requests;
+    uint64_t cache_hits;
+    uint64_t reads;
+    /* requests answered by a read that was already outstanding */
+    uint64_t collapsed;
+    uint64_t failures;
+};
+
+/* answers from the last value cache when it is fresh, otherwise reads the
+ * value from the device; concurrent requests for a point share one read.
+ * The answer goes to the read handler. Thread safe, never blocks. */
+bool bacnet_get(uint32_t id, BACNET_OBJECT_TYPE type, uint32_t instance);
+/* receives the answers of bacnet_get(), they bypass the publish policies */
+void bacnet_set_read_handler(ccov_notification_handler handler, void *context);
+point_read_stats bacnet_read_stats();
+command_queue_stats bacnet_write_queue_stats();
+/* how far behind schedule the COV renewals are */
+std::chrono::milliseconds bacnet_renewal_lag();
+request_pacer_stats bacnet_pacer_stats();
+/* outcome of a request made from a request_task */
+struct request_reply {
+    request_result result;
+    /* with request_result::error */
+    BACNET_ERROR_CLASS error_class;
+    BACNET_ERROR_CODE error_code;
+};
+struct property_reply: request_reply {
+    /* with request_result::ack, the first value of the property; the tag is
+     * MAX_BACNET_APPLICATION_TAG when it could not be decoded */
+    BACNET_APPLICATION_DATA_VALUE value;
+};
+/* Paced ReadProperty and SubscribeCOV for co_await in a request_task, only
+ * from the BACnet thread. They resume on the reply matching their invoke id,
+ * which bypasses the discovery, polling and read handlers. */
+paced_awaitable<property_reply> bacnet_read_property(
+    uint32_t device_id, BACNET_OBJECT_ID object, BACNET_PROPERTY_ID property, uint32_t array_index = BACNET_ARRAY_ALL);
+/* subscribes the point, or cancels its subscription, like the renewals do:
+ * with the bridge's subscriber process identifier, BACNET_COV_MODE and, when
+ * a cov rule gives it one, SubscribeCOVProperty with its COV increment */
+paced_awaitable<request_reply> bacnet_subscribe_cov(point_id point, bool cancel);
+/* only to be used from the BACnet thread */
+const PointTable& bacnet_points();
+/* re-reads BACNET_POINTS; newly selected points are subscribed and the
+ * subscriptions and polls of deselected ones cancelled, the rest is left
+ * alone. Returns false when there is no file or it is invalid, the previous
+ * rules stay in effect then. */
+bool bacnet_reload_points();
+/* stops subscribing, renewing and polling and cancels the active COV
+ * subscriptions so the devices' subscription tables are left clean */
+void bacnet_shutdown(std::chrono::milliseconds budget);
+/* true once the cancels are answered or the budget is spent */
+bool bacnet_shutdown_complete();
+/* adds the BACnet side counters and gauges, from the BACnet thread */
+void bacnet_metrics(MetricsReport& report);
@@ -0,0 +1,148 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+/* Bounded lock-free queue for many producers and one consumer, based on
+ * Dmitry Vyukov's bounded MPMC ring: every cell carries a sequence number
+ * telling whether it is free for the producer or ready for the consumer.
+ * Dequeue is CAS based as well so a producer can evict the oldest entry when
+ * the queue is full and the drop_oldest policy is selected. */
+enum class overflow_policy {
+    reject,
+    drop_oldest
+};
+
+struct command_queue_stats {
+    uint64_t pushed;
+    uint64_t popped;
+    uint64_t rejected;
+    uint64_t dropped;
+    size_t depth;
+    size_t max_depth;
+};
+
+template <typename T, size_t Capacity>
+class CommandQueue {
+    static_assert(Capacity >= 2 and (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+public:
+    explicit CommandQueue(overflow_policy policy = overflow_policy::reject)
+        : _policy(policy)
+    {
+        for (size_t i = 0; i < Capacity; i++) {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    void set_policy(overflow_policy policy) {
+        _policy = policy;
+    }
+
+    /* returns false when the command was rejected */
+    bool push(const T& value) {
+        for (;;) {
+            if (try_push_(value)) {
+                _pushed.fetch_add(1, std::memory_order_relaxed);
+                update_max_depth_();
+                return true;
+            }
+            if (_policy == overflow_policy::reject) {
+                _rejected.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (try_pop_()) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::optional<T> pop() {
+        auto value = try_pop_();
+        if (value) {
+            _popped.fetch_add(1, std::memory_order_relaxed);
+        }
+        return value;
+    }
+
+    size_t depth() const {
+        size_t enqueue = _enqueue_pos.load(std::memory_order_relaxed);
+        size_t dequeue = _dequeue_pos.load(std::memory_order_relaxed);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+
+    command_queue_stats stats() const {
+        return {
+            .pushed = _pushed.load(std::memory_order_relaxed),
+            .popped = _popped.load(std::memory_order_relaxed),
+            .rejected = _rejected.load(std::memory_order_relaxed),
+            .dropped = _dropped.load(std::memory_order_relaxed),
+            .depth = depth(),
+            .max_depth = _max_depth.load(std::memory_order_relaxed)
+        };
+    }
+
+private:
+    struct alignas(64) cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+    std::array<cell, Capacity> _cells;
+    alignas(64) std::atomic<size_t> _enqueue_pos{0};
+    alignas(64) std::atomic<size_t> _dequeue_pos{0};
+    alignas(64) std::atomic<uint64_t> _pushed{0};
+    std::atomic<uint64_t> _popped{0};
+    std::atomic<uint64_t> _rejected{0};
+    std::atomic<uint64_t> _dropped{0};
+    std::atomic<size_t> _max_depth{0};
+    overflow_policy _policy;
+
+    bool try_push_(const T& value) {
+        size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = _cells[pos & (Capacity - 1)];
+            size_t sequence = c.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    c.value = value;
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::optional<T> try_pop_() {
+        size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = _cells[pos & (Capacity - 1)];
+            size_t sequence = c.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    T value = c.value;
+                    c.sequence.store(pos + Capacity, std::memory_order_release);
+                    return value;
+                }
+            } else if (diff < 0) {
+                return std::nullopt;
+            } else {
+                pos = _dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void update_max_depth_() {
+        size_t current = depth();
+        size_t max_depth = _max_depth.load(std::memory_order_relaxed);
+        while (current > max_depth and
+               not _max_depth.compare_exchange_weak(max_depth, current, std::memory_order_relaxed)) {
+        }
+    }
+};
@@ -0,0 +1,69 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <queue>
+#include <vector>
+
+/* Min-heap of keys ordered by deadline on the steady clock. Popping costs
+ * O(log n) per due item, nothing is done for items that are not due.
+ * Rescheduling a key just pushes it again; the owner detects stale entries
+ * by comparing the popped deadline with the one it currently expects. */
+template <typename Key>
+class DeadlineQueue {
+public:
+    typedef std::chrono::steady_clock clock;
+
+    void schedule(const Key& key, clock::time_point deadline) {
+        _heap.push({deadline, key});
+    }
+
+    bool empty() const {
+        return _heap.empty();
+    }
+
+    size_t size() const {
+        return _heap.size();
+    }
+
+    std::optional<clock::time_point> next_deadline() const {
+        if (_heap.empty()) {
+            return std::nullopt;
+        }
+        return _heap.top().deadline;
+    }
+
+    /* milliseconds until the earliest deadline, -1 when empty */
+    long remaining_ms(clock::time_point now) const {
+        if (_heap.empty()) {
+            return -1;
+        }
+        auto remaining = std::chrono::ceil<std::chrono::milliseconds>(_heap.top().deadline - now).count();
+        return remaining > 0 ? remaining : 0;
+    }
+
+    /* calls handler(key, deadline) for up to limit items due at now */
+    template <typename Handler>
+    size_t pop_due(clock::time_point now, Handler&& handler, size_t limit = SIZE_MAX) {
+        size_t count = 0;
+        while (count < limit and not _heap.empty() and _heap.top().deadline <= now) {
+            item due = _heap.top();
+            _heap.pop();
+            handler(due.key, due.deadline);
+            count++;
+        }
+        return count;
+    }
+
+private:
+    struct item {
+        clock::time_point deadline;
+        Key key;
+        bool operator>(const item& other) const {
+            return deadline > other.deadline;
+        }
+    };
+    std::priority_queue<item, std::vector<item>, std::greater<item>> _heap;
+};
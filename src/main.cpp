@@ -1,53 +1,236 @@
 #include "mqtt.hpp"
 #include "bacnet.hpp"
-#include <thread>
+#include "reactor.hpp"
+#include "publish_limiter.hpp"
+#include "supervisor.hpp"
+#include "metrics.hpp"
+#include "topic_parser.hpp"
+#include <csignal>
+#include <cstring>
 #include <iostream>
+#include <sys/signalfd.h>
+#include <unistd.h>
 
-std::vector<std::string> split_string(const std::string& str, char delimiter) {
-    std::vector<std::string> result;
+/* value topics are published retained so new consumers get the last value */
+static bool retain_values = false;
+/* "<trunk>/" in front of every topic of a supervised worker */
+static std::string topic_prefix;
+/* from the arrival of a notification to its hand over to libmosquitto */
+static LatencyHistogram publish_latency;
+/* inbound bacnet-in/ and bacnet-get/ topics */
+static TopicParser topic_parser;
+static uint64_t malformed_topics = 0;
 
-    size_t start = 0;
-    size_t end = str.find(delimiter);
-
-    while (end != std::string_view::npos) {
-        result.push_back(str.substr(start, end - start));
-        start = end + 1;
-        end = str.find(delimiter, start);
-    }
-
-    result.push_back(str.substr(start));
-
-    return result;
+static void add_mqtt_metrics(MetricsReport& report, const MessageHandler& handler, const PublishLimiter& limiter) {
+    auto stats = handler.stats();
+    report.add("mqtt_connected", "Connected to the broker", metric_type::gauge, handler.connected());
+    report.add("mqtt_published_total", "Messages handed to libmosquitto", metric_type::counter, stats.published);
+    report.add("mqtt_spooled_total", "Messages written to the spool", metric_type::counter, stats.spooled);
+    report.add("mqtt_dropped_total", "Messages lost to a full queue or spool", metric_type::counter, stats.dropped);
+    report.add("mqtt_reconnects_total", "Reconnects to the broker", metric_type::counter, stats.reconnects);
+    report.add("mqtt_queue_depth", "Messages in the memory queue", metric_type::gauge, stats.depth);
+    report.add("mqtt_spool_bytes", "Bytes in the spool", metric_type::gauge, stats.spool_bytes);
+    report.add("mqtt_in_flight", "QoS 1 messages waiting for PUBACK", metric_type::gauge, stats.in_flight);
+    report.add("mqtt_malformed_topics_total", "Inbound messages on topics which could not be parsed", metric_type::counter, malformed_topics);
+    auto limiter_stats = limiter.stats();
+    report.add("publish_offered_total", "Values offered to the publish policies", metric_type::counter, limiter_stats.offered);
+    report.add("publish_suppressed_total", "Values within the deadband", metric_type::counter, limiter_stats.suppressed);
+    report.add("publish_conflated_total", "Values replaced by a newer one before publishing", metric_type::counter, limiter_stats.conflated);
+    report.add("publish_pending", "Values held back by rate limits or congestion", metric_type::gauge, limiter_stats.pending);
+    report.add_histogram("publish_latency_seconds", "Notification to publish latency", publish_latency.read());
 }
  
 int main(int argc, char *argv[]) {
+    /* BACNET_TRUNKS="<name>=<iface>[@<cpu>];..." runs one worker per MS/TP port */
+    if (const char *trunks_spec = std::getenv("BACNET_TRUNKS")) {
+        std::vector<trunk_config> trunks;
+        if (not parse_trunks(trunks_spec, trunks)) {
+            std::cerr << "Invalid BACNET_TRUNKS: " << trunks_spec << std::endl;
+            return 1;
+        }
+        supervise(trunks);
+    }
+    /* SIGHUP reloads BACNET_POINTS, SIGTERM and SIGINT cancel the COV
+     * subscriptions before exiting; blocked before any thread is started so
+     * they only ever arrive on the signalfd */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    const char *shutdown_budget_env = std::getenv("BACNET_SHUTDOWN_BUDGET_MS");
+    std::chrono::milliseconds shutdown_budget(shutdown_budget_env ? std::stoul(shutdown_budget_env) : 10000);
+    if (const char *prefix = std::getenv("BACNET_TOPIC_PREFIX")) {
+        topic_prefix = prefix;
+    }
     const char* mqtt_host = std::getenv("MQTT_HOST");
     const char* mqtt_port = std::getenv("MQTT_PORT");
-    MessageHandler handler(mqtt_host ? mqtt_host : "localhost", mqtt_port ? std::stol(mqtt_port) : 1883);
-    bacnet_init([&handler](uint32_t id, const std::string& type, uint32_t instance, std::string value){
-        std::string topic = "bacnet-out/" + std::to_string(id) + "/" + type + "/" + std::to_string(instance);
-        handler.pub_message(topic, value);
-    });
-    MessageHandler::add_callback([](const std::string& topic, const std::string& message) {
-        auto elements = split_string(topic, '/');
-        if (elements.size() != 4) {
+    mqtt_options options;
+    if (const char *qos = std::getenv("MQTT_QOS")) {
+        options.qos = std::stoi(qos);
+    }
+    if (const char *queue_size = std::getenv("MQTT_QUEUE_SIZE")) {
+        options.queue_size = std::stoul(queue_size);
+    }
+    if (const char *client_id = std::getenv("MQTT_CLIENT_ID")) {
+        options.client_id = client_id;
+    }
+    if (const char *spool = std::getenv("MQTT_SPOOL")) {
+        options.spool_path = spool;
+    }
+    if (const char *spool_max = std::getenv("MQTT_SPOOL_MAX_BYTES")) {
+        options.spool_max_bytes = std::stoull(spool_max);
+    }
+    options.subscriptions = {topic_prefix + "bacnet-in/#", topic_prefix + "bacnet-get/#"};
+    const char *retain = std::getenv("MQTT_RETAIN");
+    retain_values = retain and strcmp(retain, "0") != 0;
+    MessageHandler handler(mqtt_host ? mqtt_host : "localhost", mqtt_port ? std::stol(mqtt_port) : 1883, options);
+    PublishLimiter limiter(bacnet_points(), [](void *context, point_id point, const std::string& topic, std::string_view value) {
+        static_cast<MessageHandler *>(context)->pub_message(topic, value, retain_values);
+        publish_latency.observe(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - bacnet_points().updated_at[point]));
+    }, [](void *context) {
+        return static_cast<MessageHandler *>(context)->congested();
+    }, &handler);
+    const char* publish_policy = std::getenv("BACNET_PUBLISH_POLICY");
+    if (publish_policy and not limiter.configure(publish_policy)) {
+        std::cerr << "Invalid BACNET_PUBLISH_POLICY: " << publish_policy << std::endl;
+        return 1;
+    }
+    bacnet_init([](void *context, point_id point, const std::string&, std::string_view value) {
+        static_cast<PublishLimiter *>(context)->offer(point, value);
+    }, &limiter, topic_prefix + "bacnet-out/");
+    bacnet_set_read_handler([](void *context, point_id, const std::string& topic, std::string_view value) {
+        static_cast<MessageHandler *>(context)->pub_message(topic, value, retain_values);
+    }, &handler);
+    /* bacnet-device/<id> is "online" or "offline", retained */
+    bacnet_set_device_state_handler([](void *context, uint32_t device_id, bool online) {
+        static_cast<MessageHandler *>(context)->pub_message(
+            topic_prefix + "bacnet-device/" + std::to_string(device_id), online ? "online" : "offline", true);
+    }, &handler);
+    /* bacnet-result/<id>/<type>/<instance> gets the outcome of every write */
+    bacnet_set_write_result_handler([](void *context, point_id point, request_result result) {
+        const std::string& topic = bacnet_points().info(point).topic;
+        static_cast<MessageHandler *>(context)->pub_message(
+            topic_prefix + "bacnet-result/" + topic.substr(topic.find('/', topic_prefix.size()) + 1),
+            request_result_name(result));
+    }, &handler);
+    MessageHandler::add_callback([](std::string_view topic, std::string_view message) {
+        if (not topic.starts_with(topic_prefix)) {
+            return;
+        }
+        point_topic parsed;
+        if (not topic_parser.parse(topic.substr(topic_prefix.size()), parsed)) {
+            /* counted instead of logged, a misbehaving client could flood the log */
+            malformed_topics++;
             return;
         }
-	try {
-            uint32_t id = std::stoul(elements[1]);
-            const std::string& type = elements[2];
-            uint32_t instance = std::stoul(elements[3]);
-            bacnet_send(id, type, instance, message);
-	}
-	catch (const std::invalid_argument& e) {
-	    std::cerr << "Error receiving message on topic: " << topic << ". message: " << message << ". Error: " << e.what() << std::endl;
-	}
+        if (parsed.action == topic_action::read) {
+            bacnet_get(parsed.device_id, parsed.object_type, parsed.instance);
+        } else {
+            bacnet_send(parsed.device_id, parsed.object_type, parsed.instance, message, parsed.priority);
+        }
     });
  
-    while (true) {
-        bacnet_task();
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    Reactor reactor;
+    reactor.add(bacnet_fd(), EPOLLIN, [](uint32_t) {
+        bacnet_receive();
+    });
+    reactor.add(signal_fd, EPOLLIN, [&reactor, signal_fd, shutdown_budget](uint32_t) {
+        static bool stopping = false;
+        struct signalfd_siginfo info;
+        while (read(signal_fd, &info, sizeof(info)) == sizeof(info)) {
+            if (info.ssi_signo == SIGHUP) {
+                bacnet_reload_points();
+            } else if (stopping) {
+                /* a second one does not wait for the cancels */
+                reactor.stop();
+            } else {
+                stopping = true;
+                bacnet_shutdown(shutdown_budget);
+            }
+        }
+    });
+    auto mqtt_io = [&handler](uint32_t events) {
+        if (events & EPOLLIN) {
+            handler.loop_read();
+        }
+        if (events & EPOLLOUT) {
+            handler.loop_write();
+        }
+    };
+    reactor.add_prepare([] {
+        return static_cast<int>(bacnet_task());
+    });
+    reactor.add_prepare([&reactor] {
+        if (bacnet_shutdown_complete()) {
+            reactor.stop();
+            return 0;
+        }
+        return -1;
+    });
+    int mqtt_fd = -1;
+    reactor.add_prepare([&reactor, &handler, &mqtt_io, &mqtt_fd] {
+        long next = handler.loop_misc();
+        /* the socket is replaced on every reconnect, even when the number is reused */
+        if (handler.take_new_socket() or handler.socket() != mqtt_fd) {
+            if (mqtt_fd >= 0) {
+                reactor.remove(mqtt_fd);
+            }
+            mqtt_fd = handler.socket();
+            if (mqtt_fd >= 0) {
+                reactor.add(mqtt_fd, EPOLLIN, mqtt_io);
+            }
+        }
+        if (mqtt_fd >= 0) {
+            reactor.modify(mqtt_fd, handler.want_write() ? EPOLLIN | EPOLLOUT : EPOLLIN);
+        }
+        return static_cast<int>(next);
+    });
+    reactor.add_prepare([&limiter] {
+        return static_cast<int>(limiter.flush());
+    });
+    /* bacnet-stats/<metric> and BACNET_PROMETHEUS_FILE */
+    const char *stats_interval_env = std::getenv("BACNET_STATS_INTERVAL_MS");
+    std::chrono::milliseconds stats_interval(stats_interval_env ? std::stoul(stats_interval_env) : 10000);
+    const char *prometheus_file = std::getenv("BACNET_PROMETHEUS_FILE");
+    auto next_stats = std::chrono::steady_clock::now() + stats_interval;
+    if (stats_interval.count() > 0) {
+        reactor.add_prepare([&handler, &limiter, &next_stats, stats_interval, prometheus_file] {
+            auto now = std::chrono::steady_clock::now();
+            if (now < next_stats) {
+                return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(next_stats - now).count());
+            }
+            next_stats = now + stats_interval;
+            MetricsReport report;
+            bacnet_metrics(report);
+            add_mqtt_metrics(report, handler, limiter);
+            report.publish(topic_prefix + "bacnet-stats/", [](void *context, const std::string& topic, std::string_view value) {
+                static_cast<MessageHandler *>(context)->pub_message(topic, value, retain_values);
+            }, &handler);
+            if (prometheus_file and not report.write_prometheus(prometheus_file)) {
+                std::cerr << "Unable to write " << prometheus_file << std::endl;
+            }
+            return static_cast<int>(stats_interval.count());
+        });
+    }
+    if (worker_metrics *metrics = supervised_metrics()) {
+        reactor.add_prepare([metrics, &handler, &limiter] {
+            auto mqtt_stats = handler.stats();
+            auto pacer_stats = bacnet_pacer_stats();
+            metrics->points.store(bacnet_points().size(), std::memory_order_relaxed);
+            metrics->notifications.store(limiter.stats().offered, std::memory_order_relaxed);
+            metrics->published.store(mqtt_stats.published, std::memory_order_relaxed);
+            metrics->dropped.store(mqtt_stats.dropped, std::memory_order_relaxed);
+            metrics->requests.store(pacer_stats.sent, std::memory_order_relaxed);
+            metrics->timeouts.store(pacer_stats.timeouts, std::memory_order_relaxed);
+            metrics->queue_depth.store(mqtt_stats.depth, std::memory_order_relaxed);
+            return -1;
+        });
     }
+    reactor.run();
 
     return 0;
 }
@@ -0,0 +1,181 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+void append_number(std::string& out, double value) {
+    char text[32];
+    auto result = std::to_chars(text, text + sizeof(text), value);
+    out.append(text, result.ptr - text);
+}
+
+const char *type_name(metric_type type) {
+    switch (type) {
+        case metric_type::counter:
+            return "counter";
+        case metric_type::gauge:
+            return "gauge";
+        default:
+            return "histogram";
+    }
+}
+
+}
+
+void LatencyHistogram::observe(std::chrono::microseconds latency) {
+    uint64_t us = latency.count() > 0 ? static_cast<uint64_t>(latency.count()) : 0;
+    /* smallest i with us <= 2^i */
+    size_t bucket = us <= 1 ? 0 : std::bit_width(us - 1);
+    _buckets[std::min(bucket, bucket_count - 1)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum_us.fetch_add(us, std::memory_order_relaxed);
+    uint64_t max = _max_us.load(std::memory_order_relaxed);
+    while (us > max and not _max_us.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+LatencyHistogram::snapshot LatencyHistogram::read() const {
+    snapshot result;
+    for (size_t i = 0; i < bucket_count; i++) {
+        result.buckets[i] = _buckets[i].load(std::memory_order_relaxed);
+    }
+    result.count = _count.load(std::memory_order_relaxed);
+    result.sum_us = _sum_us.load(std::memory_order_relaxed);
+    result.max_us = _max_us.load(std::memory_order_relaxed);
+    return result;
+}
+
+uint64_t LatencyHistogram::bucket_bound_us(size_t bucket) {
+    return bucket + 1 < bucket_count ? uint64_t(1) << bucket : UINT64_MAX;
+}
+
+double LatencyHistogram::snapshot::quantile_ms(double quantile) const {
+    uint64_t total = 0;
+    for (uint64_t bucket: buckets) {
+        total += bucket;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(quantile * total);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; i++) {
+        seen += buckets[i];
+        if (seen > rank) {
+            return std::min(bucket_bound_us(i), max_us) / 1000.0;
+        }
+    }
+    return max_us / 1000.0;
+}
+
+MetricsReport::family& MetricsReport::family_(const char *name, const char *help, metric_type type, const char *label) {
+    if (_families.empty() or strcmp(_families.back().name, name) != 0) {
+        _families.push_back({.name = name, .help = help, .type = type, .label = label});
+    }
+    return _families.back();
+}
+
+void MetricsReport::add(const char *name, const char *help, metric_type type, double value) {
+    family_(name, help, type, nullptr).samples.push_back({.value = value});
+}
+
+void MetricsReport::add(const char *name, const char *help, metric_type type, const char *label, const std::string& label_value, double value) {
+    family_(name, help, type, label).samples.push_back({.label_value = label_value, .value = value});
+}
+
+void MetricsReport::add_histogram(const char *name, const char *help, const LatencyHistogram::snapshot& histogram) {
+    family_(name, help, metric_type::histogram, nullptr).histogram = histogram;
+}
+
+std::string MetricsReport::prometheus() const {
+    std::string out;
+    for (const auto& family: _families) {
+        out.append("# HELP ").append(family.name).append(" ").append(family.help).append("\n");
+        out.append("# TYPE ").append(family.name).append(" ").append(type_name(family.type)).append("\n");
+        if (family.type == metric_type::histogram) {
+            /* in seconds, as Prometheus expects */
+            const auto& histogram = family.histogram;
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < LatencyHistogram::bucket_count; i++) {
+                cumulative += histogram.buckets[i];
+                out.append(family.name).append("_bucket{le=\"");
+                if (i + 1 < LatencyHistogram::bucket_count) {
+                    append_number(out, LatencyHistogram::bucket_bound_us(i) / 1e6);
+                } else {
+                    out.append("+Inf");
+                }
+                out.append("\"} ");
+                append_number(out, static_cast<double>(cumulative));
+                out.append("\n");
+            }
+            out.append(family.name).append("_sum ");
+            append_number(out, histogram.sum_us / 1e6);
+            out.append("\n").append(family.name).append("_count ");
+            append_number(out, static_cast<double>(histogram.count));
+            out.append("\n");
+            continue;
+        }
+        for (const auto& sample: family.samples) {
+            out.append(family.name);
+            if (family.label) {
+                out.append("{").append(family.label).append("=\"").append(sample.label_value).append("\"}");
+            }
+            out.append(" ");
+            append_number(out, sample.value);
+            out.append("\n");
+        }
+    }
+    return out;
+}
+
+bool MetricsReport::write_prometheus(const std::string& path) const {
+    std::string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "w");
+    if (file == nullptr) {
+        return false;
+    }
+    std::string text = prometheus();
+    bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+    written = fclose(file) == 0 and written;
+    return written and rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+void MetricsReport::publish(const std::string& prefix, publish_function publish, void *context) const {
+    std::string topic;
+    std::string value;
+    for (const auto& family: _families) {
+        topic.assign(prefix).append(family.name);
+        size_t base = topic.size();
+        if (family.type == metric_type::histogram) {
+            const auto& histogram = family.histogram;
+            std::pair<const char *, double> values[] = {
+                {"/count", static_cast<double>(histogram.count)},
+                {"/p50_ms", histogram.quantile_ms(0.5)},
+                {"/p90_ms", histogram.quantile_ms(0.9)},
+                {"/p99_ms", histogram.quantile_ms(0.99)},
+                {"/max_ms", histogram.max_us / 1000.0}
+            };
+            for (const auto& [suffix, number]: values) {
+                topic.resize(base);
+                topic.append(suffix);
+                value.clear();
+                append_number(value, number);
+                publish(context, topic, value);
+            }
+            continue;
+        }
+        for (const auto& sample: family.samples) {
+            topic.resize(base);
+            if (family.label) {
+                topic.append("/").append(sample.label_value);
+            }
+            value.clear();
+            append_number(value, sample.value);
+            publish(context, topic, value);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Latency distribution in power of two buckets of microseconds, up to about
+ * two minutes. observe() is a few relaxed atomic adds, safe from any thread
+ * and without locks. */
+class LatencyHistogram {
+public:
+    /* bucket i counts values up to 2^i us, the last one everything above */
+    static constexpr size_t bucket_count = 28;
+    struct snapshot {
+        std::array<uint64_t, bucket_count> buckets;
+        uint64_t count;
+        uint64_t sum_us;
+        uint64_t max_us;
+        /* upper bound of the bucket holding the quantile, in ms */
+        double quantile_ms(double quantile) const;
+    };
+
+    void observe(std::chrono::microseconds latency);
+    snapshot read() const;
+    /* upper bound of a bucket in us, UINT64_MAX for the last one */
+    static uint64_t bucket_bound_us(size_t bucket);
+
+private:
+    std::array<std::atomic<uint64_t>, bucket_count> _buckets = {};
+    std::atomic<uint64_t> _count{0};
+    std::atomic<uint64_t> _sum_us{0};
+    std::atomic<uint64_t> _max_us{0};
+};
+
+enum class metric_type {
+    counter,
+    gauge,
+    histogram
+};
+
+/* One round of metrics, collected on the reactor thread and exported as
+ * Prometheus text and as MQTT topics <prefix><name>[/<label value>]. A
+ * histogram becomes the count, p50_ms, p90_ms, p99_ms and max_ms sub topics. */
+class MetricsReport {
+public:
+    typedef void (*publish_function)(void *context, const std::string& topic, std::string_view value);
+
+    void add(const char *name, const char *help, metric_type type, double value);
+    /* one sample of a family with a single label, e.g. device="12" */
+    void add(const char *name, const char *help, metric_type type, const char *label, const std::string& label_value, double value);
+    void add_histogram(const char *name, const char *help, const LatencyHistogram::snapshot& histogram);
+
+    std::string prometheus() const;
+    /* written to a temporary file and renamed, for the node exporter's
+     * textfile collector */
+    bool write_prometheus(const std::string& path) const;
+    void publish(const std::string& prefix, publish_function publish, void *context) const;
+
+private:
+    struct sample {
+        std::string label_value;
+        double value;
+    };
+    struct family {
+        const char *name;
+        const char *help;
+        metric_type type;
+        const char *label;
+        std::vector<sample> samples;
+        LatencyHistogram::snapshot histogram;
+    };
+    std::vector<family> _families;
+
+    family& family_(const char *name, const char *help, metric_type type, const char *label);
+};
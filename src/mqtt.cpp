@@ -1,78 +1,241 @@
 #include "mqtt.hpp"
+#include <algorithm>
 #include <iostream>
-#include <thread>
+#include <utility>
 
-MessageHandler::MessageHandler(const std::string& host, const int port)
+namespace {
+
+const std::chrono::seconds min_reconnect_delay(2);
+const std::chrono::seconds max_reconnect_delay(60);
+/* keeps a long replay from starving the BACnet side */
+const unsigned max_replay_per_run = 256;
+
+}
+
+MessageHandler::MessageHandler(const std::string& host, const int port, const mqtt_options& options)
     : _host(host)
     , _port(port)
+    , _options(options)
 {
     init_();
 }
 
 MessageHandler::~MessageHandler() {
     if (_connected) {
-        mosquitto_lib_cleanup();
-        mosquitto_destroy(_mosq);
+        mosquitto_disconnect(_mosq);
     }
+    mosquitto_destroy(_mosq);
+    mosquitto_lib_cleanup();
 }
 void MessageHandler::init_() {
-    // init publish struct
-    _mosq = mosquitto_new(nullptr, true, nullptr);
-    if (mosquitto_connect(_mosq, _host.c_str(), _port, _keep_alive) != MOSQ_ERR_SUCCESS) {
-        std::cerr << "connect error!!" << std::endl;
-        _connected = false;
-        exit(-1);
-    } else {
-        _connected = true;
-    }
-    std::cout << "publish init finished" << std::endl;
-
-    // init recive callback
-    mosquitto_lib_init(); 
-
-    auto register_callback = [this] {
-        mosquitto_subscribe_callback(
-            &MessageHandler::call_back_func,
-            NULL,
-            "bacnet-in/#",
-            0,
-            _host.c_str(),
-            _port,
-            NULL,
-            60,
-            true,
-            NULL,
-            NULL,
-            NULL,
-            NULL
-        );
-        // this api can not return??
-    };
-    std::thread register_callback_thread(register_callback);
-    register_callback_thread.detach();
-    std::cout << "finished callback init" << std::endl;
-}
-
-int MessageHandler::call_back_func(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *msg) {
-    std::cout << "FROM topic: " << msg->topic << std::endl;
-    std::string message(reinterpret_cast<char *>(msg->payload), msg->payloadlen);
-    std::cout << "GOT message: " << message << std::endl;
-    callback_(msg->topic, message);
-    return 0;
-}
-
-int MessageHandler::pub_message(const std::string& topic, const std::string& message) {
-    if (mosquitto_publish(_mosq, nullptr, topic.c_str(),
-                      static_cast<int>(message.length()) + 1,
-                      message.c_str(), 0, 0) != MOSQ_ERR_SUCCESS) {
-
-        std::cerr  << "MQTT publish error." << std::endl;
-        return 1;
-    }
-    return 0;
-}
-
-std::function<void(const std::string&, const std::string&)> MessageHandler::callback_;
-void MessageHandler::add_callback(std::function<void(const std::string&, const std::string&)> callback) {
+    mosquitto_lib_init();
+    bool clean_session = _options.client_id.empty();
+    _mosq = mosquitto_new(clean_session ? nullptr : _options.client_id.c_str(), clean_session, this);
+    mosquitto_connect_callback_set(_mosq, &MessageHandler::connect_func);
+    mosquitto_disconnect_callback_set(_mosq, &MessageHandler::disconnect_func);
+    mosquitto_publish_callback_set(_mosq, &MessageHandler::publish_func);
+    mosquitto_message_callback_set(_mosq, &MessageHandler::call_back_func);
+    mosquitto_max_inflight_messages_set(_mosq, _options.max_in_flight);
+    _options.qos = std::clamp(_options.qos, 0, 1);
+    _queue.resize(std::max<size_t>(_options.queue_size, 1));
+    if (not _options.spool_path.empty()) {
+        _spool.open(_options.spool_path, _options.spool_max_bytes);
+    }
+    _reconnect_delay = min_reconnect_delay;
+    connect_();
+}
+
+void MessageHandler::connect_() {
+    /* also the deadline for this attempt, a hanging connect is retried */
+    _reconnect_at = clock::now() + _reconnect_delay;
+    _reconnect_delay = std::min(_reconnect_delay * 2, max_reconnect_delay);
+    int rc = mosquitto_connect_async(_mosq, _host.c_str(), _port, _keep_alive);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        std::cerr << "MQTT connect error: " << mosquitto_strerror(rc) << std::endl;
+    }
+    _new_socket = true;
+}
+
+void MessageHandler::connect_func(struct mosquitto *mosq, void *userdata, int result) {
+    if (result != 0) {
+        std::cerr << "MQTT connection refused: " << result << std::endl;
+        return;
+    }
+    auto *handler = static_cast<MessageHandler *>(userdata);
+    handler->_stats.reconnects += handler->_connected_once;
+    handler->_connected = true;
+    handler->_connected_once = true;
+    handler->_reconnect_delay = min_reconnect_delay;
+    /* libmosquitto resends its own unacknowledged messages */
+    handler->_stats.in_flight = 0;
+    /* (re)subscribe on every connect: a clean session starts without
+     * subscriptions, and even a persistent one is gone after a broker
+     * restart or session expiry; subscribing again is harmless */
+    for (const auto& topic: handler->_options.subscriptions) {
+        if (mosquitto_subscribe(mosq, nullptr, topic.c_str(), 0) != MOSQ_ERR_SUCCESS) {
+            std::cerr << "MQTT subscribe error." << std::endl;
+        }
+    }
+}
+
+void MessageHandler::disconnect_func(struct mosquitto *mosq, void *userdata, int result) {
+    auto *handler = static_cast<MessageHandler *>(userdata);
+    if (handler->_connected) {
+        std::cerr << "MQTT connection lost: " << mosquitto_strerror(result) << std::endl;
+        handler->_reconnect_at = clock::now() + handler->_reconnect_delay;
+    }
+    handler->_connected = false;
+}
+
+void MessageHandler::publish_func(struct mosquitto *mosq, void *userdata, int mid) {
+    auto *handler = static_cast<MessageHandler *>(userdata);
+    if (handler->_options.qos > 0 and handler->_stats.in_flight > 0) {
+        handler->_stats.in_flight--;
+    }
+}
+
+void MessageHandler::call_back_func(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *msg) {
+    /* both point into libmosquitto's message, valid for the call only */
+    if (callback_) {
+        callback_(msg->topic, std::string_view(static_cast<const char *>(msg->payload), msg->payloadlen));
+    }
+}
+
+bool MessageHandler::can_send_() const {
+    return _connected and not want_write() and
+        (_options.qos == 0 or _stats.in_flight < _options.max_in_flight);
+}
+
+bool MessageHandler::send_(const char *topic, std::string_view message, bool retain) {
+    int rc = mosquitto_publish(_mosq, nullptr, topic, static_cast<int>(message.length()),
+                               message.data(), _options.qos, retain);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        if (rc == MOSQ_ERR_NO_CONN or rc == MOSQ_ERR_CONN_LOST) {
+            disconnect_func(_mosq, this, rc);
+        } else {
+            std::cerr << "MQTT publish error: " << mosquitto_strerror(rc) << std::endl;
+        }
+        return false;
+    }
+    _stats.published++;
+    _stats.in_flight += _options.qos > 0;
+    return true;
+}
+
+void MessageHandler::enqueue_(std::string_view topic, std::string_view message, bool retain) {
+    /* once spooling, everything goes to the spool to keep the order */
+    if (_queue_count == _queue.size() or not _spool.empty()) {
+        if (_spool.is_open()) {
+            if (_spool.append(topic, message, retain)) {
+                _stats.spooled++;
+            } else {
+                _stats.dropped++;
+            }
+            return;
+        }
+        _queue_head = (_queue_head + 1) % _queue.size();
+        _queue_count--;
+        _stats.dropped++;
+    }
+    auto& slot = _queue[(_queue_head + _queue_count) % _queue.size()];
+    slot.topic.assign(topic);
+    slot.payload.assign(message);
+    slot.retain = retain;
+    _queue_count++;
+    _stats.queued++;
+    _stats.max_depth = std::max(_stats.max_depth, _queue_count);
+}
+
+void MessageHandler::replay_() {
+    for (unsigned count = 0; count < max_replay_per_run and can_send_(); count++) {
+        if (_queue_count > 0) {
+            auto& message = _queue[_queue_head];
+            if (not send_(message.topic.c_str(), message.payload, message.retain)) {
+                return;
+            }
+            _queue_head = (_queue_head + 1) % _queue.size();
+            _queue_count--;
+            continue;
+        }
+        std::string_view topic;
+        std::string_view payload;
+        bool retain = false;
+        if (not _spool.front(topic, payload, retain)) {
+            return;
+        }
+        _spool_topic.assign(topic);
+        if (not send_(_spool_topic.c_str(), payload, retain)) {
+            return;
+        }
+        _spool.pop();
+        _stats.replayed++;
+    }
+}
+
+int MessageHandler::pub_message(const std::string& topic, std::string_view message, bool retain) {
+    if (_queue_count == 0 and _spool.empty() and can_send_() and send_(topic.c_str(), message, retain)) {
+        return 0;
+    }
+    uint64_t dropped = _stats.dropped;
+    enqueue_(topic, message, retain);
+    return _stats.dropped == dropped ? 0 : 1;
+}
+
+std::function<void(std::string_view, std::string_view)> MessageHandler::callback_;
+void MessageHandler::add_callback(std::function<void(std::string_view topic, std::string_view message)> callback) {
     callback_ = callback;
 }
+
+int MessageHandler::socket() const {
+    return mosquitto_socket(_mosq);
+}
+
+bool MessageHandler::take_new_socket() {
+    return std::exchange(_new_socket, false);
+}
+
+bool MessageHandler::want_write() const {
+    return mosquitto_want_write(_mosq);
+}
+
+bool MessageHandler::congested() const {
+    /* while disconnected messages go to the queue and the spool instead */
+    return _connected and (want_write() or _queue_count > 0 or not _spool.empty());
+}
+
+void MessageHandler::loop_read() {
+    int rc = mosquitto_loop_read(_mosq, 1);
+    if (rc != MOSQ_ERR_SUCCESS and rc != MOSQ_ERR_NO_CONN) {
+        std::cerr << "MQTT read error: " << mosquitto_strerror(rc) << std::endl;
+    }
+}
+
+void MessageHandler::loop_write() {
+    int rc = mosquitto_loop_write(_mosq, 1);
+    if (rc != MOSQ_ERR_SUCCESS and rc != MOSQ_ERR_NO_CONN) {
+        std::cerr << "MQTT write error: " << mosquitto_strerror(rc) << std::endl;
+    }
+}
+
+long MessageHandler::loop_misc() {
+    auto now = clock::now();
+    mosquitto_loop_misc(_mosq);
+    if (not _connected and now >= _reconnect_at) {
+        connect_();
+    }
+    replay_();
+    if (not _connected) {
+        return std::chrono::ceil<std::chrono::milliseconds>(_reconnect_at - now).count();
+    }
+    if ((_queue_count > 0 or not _spool.empty()) and can_send_()) {
+        return 0;
+    }
+    return 1000;
+}
+
+mqtt_publisher_stats MessageHandler::stats() const {
+    mqtt_publisher_stats stats = _stats;
+    stats.depth = _queue_count;
+    stats.spool_bytes = _spool.size();
+    return stats;
+}
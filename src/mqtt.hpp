@@ -1,23 +1,106 @@
 #pragma once
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <functional>
+#include <vector>
 #include <mosquitto.h>
+#include "spool.hpp"
 
+struct mqtt_options {
+    /* 0 or 1 */
+    int qos = 0;
+    /* messages held in memory while the broker is unreachable */
+    size_t queue_size = 4096;
+    /* QoS 1 messages handed to libmosquitto before waiting for PUBACKs */
+    unsigned max_in_flight = 20;
+    /* empty for a random id and a clean session */
+    std::string client_id;
+    /* overflow of the memory queue, empty to drop the oldest message */
+    std::string spool_path;
+    uint64_t spool_max_bytes = 64 * 1024 * 1024;
+    /* subscribed on every connect */
+    std::vector<std::string> subscriptions = {"bacnet-in/#", "bacnet-get/#"};
+};
+
+struct mqtt_publisher_stats {
+    uint64_t published;
+    uint64_t queued;
+    uint64_t spooled;
+    uint64_t replayed;
+    uint64_t dropped;
+    uint64_t reconnects;
+    size_t depth;
+    size_t max_depth;
+    uint64_t spool_bytes;
+    unsigned in_flight;
+};
+
+/* Publisher for the MQTT side. The connection is made asynchronously and
+ * re-established with exponential backoff; nothing here blocks or exits when
+ * the broker is down. Messages that can not be handed to libmosquitto right
+ * away go to a bounded in-memory queue and from there to the optional spool
+ * file, both are replayed in order once the broker is back. */
 class MessageHandler {
 public:
-    MessageHandler(const std::string& host, const int port);
+    typedef std::chrono::steady_clock clock;
+
+    MessageHandler(const std::string& host, const int port, const mqtt_options& options = {});
     ~MessageHandler();
-    static int call_back_func(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *msg);
-    int pub_message(const std::string& topic, const std::string& message);
-    static void add_callback(std::function<void(const std::string&, const std::string&)> callback);
+    static void call_back_func(struct mosquitto *mosq, void *userdata, const struct mosquitto_message *msg);
+    static void connect_func(struct mosquitto *mosq, void *userdata, int result);
+    static void disconnect_func(struct mosquitto *mosq, void *userdata, int result);
+    static void publish_func(struct mosquitto *mosq, void *userdata, int mid);
+    /* never blocks; returns 0 when the message was sent or queued */
+    int pub_message(const std::string& topic, std::string_view message, bool retain = false);
+    static void add_callback(std::function<void(std::string_view topic, std::string_view message)> callback);
+
+    /* network loop, driven by the reactor */
+    int socket() const;
+    /* true once after a new socket was created, it has to be registered again */
+    bool take_new_socket();
+    bool want_write() const;
+    /* outbound data is backing up while connected */
+    bool congested() const;
+    bool connected() const {
+        return _connected;
+    }
+    void loop_read();
+    void loop_write();
+    /* keepalive, reconnect and queue replay, returns ms until the next run */
+    long loop_misc();
+    mqtt_publisher_stats stats() const;
 
 private:
+    struct outbound_message {
+        std::string topic;
+        std::string payload;
+        bool retain;
+    };
     struct mosquitto* _mosq = nullptr;
     std::string _host;
     int _port;
     int _keep_alive = 60;
+    mqtt_options _options;
     bool _connected = false;
-    static std::function<void(const std::string&, const std::string&)> callback_;
+    bool _connected_once = false;
+    bool _new_socket = false;
+    clock::time_point _reconnect_at;
+    std::chrono::seconds _reconnect_delay{1};
+    /* ring of reused strings, no allocation once warmed up */
+    std::vector<outbound_message> _queue;
+    size_t _queue_head = 0;
+    size_t _queue_count = 0;
+    Spool _spool;
+    /* NUL terminated copy of the topic being replayed from the spool */
+    std::string _spool_topic;
+    mqtt_publisher_stats _stats = {};
+    static std::function<void(std::string_view, std::string_view)> callback_;
     void init_();
+    void connect_();
+    bool can_send_() const;
+    bool send_(const char *topic, std::string_view message, bool retain);
+    void enqueue_(std::string_view topic, std::string_view message, bool retain);
+    void replay_();
 };
-
@@ -0,0 +1,184 @@
+#include "pacer.hpp"
+#include <algorithm>
+#include <bacnet/basic/tsm/tsm.h>
+
+const char *request_result_name(request_result result) {
+    switch (result) {
+        case request_result::ack: return "ack";
+        case request_result::error: return "error";
+        case request_result::abort: return "abort";
+        case request_result::reject: return "reject";
+        case request_result::timeout: return "timeout";
+    }
+    return "unknown";
+}
+
+void RequestPacer::configure(unsigned max_in_flight, unsigned max_per_device, unsigned max_attempts) {
+    _max_in_flight = std::max(max_in_flight, 1u);
+    _max_per_device = std::max(max_per_device, 1u);
+    _max_attempts = std::max(max_attempts, 1u);
+}
+
+void RequestPacer::make_ready_(uint32_t device_id, device_queue& device) {
+    if (not device.ready and not device.pending.empty() and device.in_flight < _max_per_device) {
+        device.ready = true;
+        _ready.push_back(device_id);
+    }
+}
+
+void RequestPacer::submit(paced_request request) {
+    uint32_t device_id = request.device_id;
+    auto& device = _devices[device_id];
+    device.pending.push_back(std::move(request));
+    make_ready_(device_id, device);
+}
+
+void RequestPacer::retry_or_fail_(paced_request request, request_result result) {
+    if (request.attempts < _max_attempts) {
+        _stats.retries++;
+        auto backoff = std::chrono::seconds(1u << std::min(request.attempts, 6u));
+        uint64_t retry_id = _next_retry_id++;
+        _retry_queue.schedule(retry_id, DeadlineQueue<uint64_t>::clock::now() + backoff);
+        _retries.emplace(retry_id, std::move(request));
+        return;
+    }
+    _stats.failures++;
+    if (request.done) {
+        request.done(result);
+    }
+}
+
+void RequestPacer::complete(uint8_t invoke_id, request_result result) {
+    auto& slot = _requests[invoke_id];
+    if (not slot.active) {
+        return;
+    }
+    slot.active = false;
+    paced_request request = std::move(slot.request);
+    _in_flight--;
+    auto device_it = _devices.find(request.device_id);
+    if (device_it != _devices.end()) {
+        device_it->second.in_flight--;
+        make_ready_(device_it->first, device_it->second);
+    }
+    switch (result) {
+        case request_result::ack:
+            _stats.acks++;
+            break;
+        case request_result::error:
+            _stats.errors++;
+            break;
+        case request_result::abort:
+            _stats.aborts++;
+            break;
+        case request_result::reject:
+            _stats.rejects++;
+            break;
+        case request_result::timeout:
+            _stats.timeouts++;
+            break;
+    }
+    if (result != request_result::timeout and _on_reply) {
+        _on_reply(request.device_id);
+    }
+    if (result == request_result::timeout or result == request_result::abort) {
+        retry_or_fail_(std::move(request), result);
+    } else if (request.done) {
+        request.done(result);
+    }
+}
+
+long RequestPacer::task() {
+    _retry_queue.pop_due(DeadlineQueue<uint64_t>::clock::now(), [this](uint64_t retry_id, auto) {
+        auto retry_it = _retries.find(retry_id);
+        if (retry_it == _retries.end()) {
+            return;
+        }
+        uint32_t device_id = retry_it->second.device_id;
+        auto& device = _devices[device_id];
+        device.pending.push_front(std::move(retry_it->second));
+        _retries.erase(retry_it);
+        make_ready_(device_id, device);
+    });
+
+    while (_in_flight < _max_in_flight and not _ready.empty() and tsm_transaction_available()) {
+        uint32_t device_id = _ready.front();
+        _ready.pop_front();
+        auto device_it = _devices.find(device_id);
+        if (device_it == _devices.end()) {
+            continue;
+        }
+        auto& device = device_it->second;
+        device.ready = false;
+        if (device.pending.empty() or device.in_flight >= _max_per_device) {
+            continue;
+        }
+        paced_request request = std::move(device.pending.front());
+        device.pending.pop_front();
+        request.attempts++;
+        uint8_t invoke_id = request.send();
+        if (invoke_id == 0) {
+            /* device not bound yet or encoding failed; may call back into submit() */
+            make_ready_(device_id, device);
+            retry_or_fail_(std::move(request), request_result::timeout);
+            continue;
+        }
+        auto& slot = _requests[invoke_id];
+        std::optional<paced_request> lost;
+        if (slot.active) {
+            /* the stack reused the id, the old request is gone */
+            slot.active = false;
+            _in_flight--;
+            auto old_device_it = _devices.find(slot.request.device_id);
+            if (old_device_it != _devices.end()) {
+                old_device_it->second.in_flight--;
+                make_ready_(old_device_it->first, old_device_it->second);
+            }
+            lost = std::move(slot.request);
+            if (_on_reused) {
+                _on_reused(invoke_id);
+            }
+        }
+        _stats.sent++;
+        if (request.sent) {
+            request.sent(invoke_id);
+        }
+        slot.request = std::move(request);
+        slot.active = true;
+        device.in_flight++;
+        _in_flight++;
+        make_ready_(device_id, device);
+        if (lost) {
+            /* last, it may call back into submit() */
+            retry_or_fail_(std::move(*lost), request_result::timeout);
+        }
+    }
+    return _retry_queue.remaining_ms(DeadlineQueue<uint64_t>::clock::now());
+}
+
+void RequestPacer::on_reply(std::function<void(uint32_t device_id)> handler) {
+    _on_reply = std::move(handler);
+}
+
+void RequestPacer::on_reused(std::function<void(uint8_t invoke_id)> handler) {
+    _on_reused = std::move(handler);
+}
+
+bool RequestPacer::idle() const {
+    if (_in_flight != 0 or not _retries.empty()) {
+        return false;
+    }
+    return std::all_of(_devices.begin(), _devices.end(), [](const auto& device) {
+        return device.second.pending.empty();
+    });
+}
+
+request_pacer_stats RequestPacer::stats() const {
+    request_pacer_stats stats = _stats;
+    stats.queued = _retries.size();
+    for (const auto& [device_id, device]: _devices) {
+        stats.queued += device.pending.size();
+    }
+    stats.in_flight = _in_flight;
+    return stats;
+}
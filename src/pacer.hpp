@@ -0,0 +1,94 @@
+#pragma once
+#include "deadline_queue.hpp"
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+
+enum class request_result {
+    ack,
+    error,
+    abort,
+    reject,
+    timeout
+};
+
+/* "ack", "error", ... for logs and MQTT payloads */
+const char *request_result_name(request_result result);
+
+/* confirmed request waiting for an invoke id */
+struct paced_request {
+    uint32_t device_id;
+    /* encodes and sends the request, returns the invoke id or 0 on failure */
+    std::function<uint8_t()> send;
+    /* called once with the final outcome, after retries */
+    std::function<void(request_result)> done;
+    /* optional, called with the invoke id of every attempt once it is in
+     * flight, for state the replies are matched with by invoke id */
+    std::function<void(uint8_t)> sent;
+    unsigned attempts = 0;
+};
+
+struct request_pacer_stats {
+    size_t queued;
+    unsigned in_flight;
+    uint64_t sent;
+    uint64_t retries;
+    uint64_t acks;
+    uint64_t errors;
+    uint64_t aborts;
+    uint64_t rejects;
+    uint64_t timeouts;
+    uint64_t failures;
+};
+
+/* Outbound scheduler for confirmed services. Requests are queued per device
+ * and sent round-robin across devices while at most max_per_device requests
+ * are in flight per device and max_in_flight overall. Replies are matched by
+ * invoke id; timeouts and aborts are retried with exponential backoff. */
+class RequestPacer {
+public:
+    void configure(unsigned max_in_flight, unsigned max_per_device, unsigned max_attempts);
+    void submit(paced_request request);
+    /* to be called from the ack, error, abort, reject and timeout handlers */
+    void complete(uint8_t invoke_id, request_result result);
+    /* sends what the windows allow, returns ms until the next retry or -1 */
+    long task();
+    /* called with the device of every reply except timeouts, the device is
+     * alive whatever it answered */
+    void on_reply(std::function<void(uint32_t device_id)> handler);
+    /* called when the stack hands out an invoke id that is still in flight,
+     * before the new request takes it over; the old one is retried */
+    void on_reused(std::function<void(uint8_t invoke_id)> handler);
+    bool idle() const;
+    request_pacer_stats stats() const;
+
+private:
+    struct device_queue {
+        std::deque<paced_request> pending;
+        unsigned in_flight = 0;
+        bool ready = false;
+    };
+    struct in_flight_request {
+        paced_request request;
+        bool active = false;
+    };
+    unsigned _max_in_flight = 8;
+    unsigned _max_per_device = 1;
+    unsigned _max_attempts = 3;
+    unsigned _in_flight = 0;
+    std::unordered_map<uint32_t, device_queue> _devices;
+    std::deque<uint32_t> _ready;
+    std::array<in_flight_request, 256> _requests;
+    DeadlineQueue<uint64_t> _retry_queue;
+    std::unordered_map<uint64_t, paced_request> _retries;
+    uint64_t _next_retry_id = 0;
+    request_pacer_stats _stats = {};
+    std::function<void(uint32_t)> _on_reply;
+    std::function<void(uint8_t)> _on_reused;
+
+    void make_ready_(uint32_t device_id, device_queue& device);
+    void retry_or_fail_(paced_request request, request_result result);
+};
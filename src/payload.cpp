@@ -0,0 +1,464 @@
+#include "payload.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+class Output {
+public:
+    Output(char *buffer, size_t size)
+        : _buffer(buffer)
+        , _size(size)
+    {
+    }
+    void put(char c) {
+        if (_length < _size) {
+            _buffer[_length] = c;
+        }
+        _length++;
+    }
+    void put(const void *bytes, size_t length) {
+        if (_length + length <= _size) {
+            memcpy(_buffer + _length, bytes, length);
+        }
+        _length += length;
+    }
+    template <typename T>
+    void number(T value) {
+        char text[32];
+        auto result = std::to_chars(text, text + sizeof(text), value);
+        put(text, result.ptr - text);
+    }
+    /* 0 once anything did not fit */
+    size_t length() const {
+        return _length <= _size ? _length : 0;
+    }
+
+private:
+    char *_buffer;
+    size_t _size;
+    size_t _length = 0;
+};
+
+class JsonWriter {
+public:
+    explicit JsonWriter(Output& out)
+        : _out(out)
+    {
+    }
+    void begin_map(size_t) {
+        separator_();
+        _out.put('{');
+        push_();
+    }
+    void end_map() {
+        _out.put('}');
+        _depth--;
+    }
+    void begin_array(size_t) {
+        separator_();
+        _out.put('[');
+        push_();
+    }
+    void end_array() {
+        _out.put(']');
+        _depth--;
+    }
+    void key(const char *name) {
+        separator_();
+        _out.put('"');
+        _out.put(name, strlen(name));
+        _out.put("\":", 2);
+        _after_key = true;
+    }
+    void null() {
+        separator_();
+        _out.put("null", 4);
+    }
+    void boolean(bool value) {
+        separator_();
+        value ? _out.put("true", 4) : _out.put("false", 5);
+    }
+    void unsigned_int(uint64_t value) {
+        separator_();
+        _out.number(value);
+    }
+    void signed_int(int64_t value) {
+        separator_();
+        _out.number(value);
+    }
+    template <typename T>
+    void real(T value) {
+        separator_();
+        if (std::isfinite(value)) {
+            _out.number(value);
+        } else {
+            _out.put("null", 4);
+        }
+    }
+    void text(const char *value, size_t length) {
+        separator_();
+        _out.put('"');
+        for (size_t i = 0; i < length; i++) {
+            unsigned char c = value[i];
+            if (c == '"' or c == '\\') {
+                _out.put('\\');
+                _out.put(c);
+            } else if (c < 0x20) {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                _out.put(escaped, 6);
+            } else {
+                _out.put(c);
+            }
+        }
+        _out.put('"');
+    }
+    void bytes(const uint8_t *value, size_t length) {
+        static const char hex[] = "0123456789abcdef";
+        separator_();
+        _out.put('"');
+        for (size_t i = 0; i < length; i++) {
+            _out.put(hex[value[i] >> 4]);
+            _out.put(hex[value[i] & 0xf]);
+        }
+        _out.put('"');
+    }
+
+private:
+    Output& _out;
+    /* per nesting level, whether the next item needs a comma */
+    bool _need_comma[8] = {};
+    size_t _depth = 0;
+    bool _after_key = false;
+
+    void push_() {
+        _depth++;
+        _need_comma[_depth] = false;
+    }
+    void separator_() {
+        if (_after_key) {
+            _after_key = false;
+            return;
+        }
+        if (_depth > 0 and _need_comma[_depth]) {
+            _out.put(',');
+        }
+        _need_comma[_depth] = true;
+    }
+};
+
+/* RFC 8949, definite lengths only */
+class CborWriter {
+public:
+    explicit CborWriter(Output& out)
+        : _out(out)
+    {
+    }
+    void begin_map(size_t count) {
+        head_(5, count);
+    }
+    void end_map() {
+    }
+    void begin_array(size_t count) {
+        head_(4, count);
+    }
+    void end_array() {
+    }
+    void key(const char *name) {
+        text(name, strlen(name));
+    }
+    void null() {
+        _out.put(static_cast<char>(0xf6));
+    }
+    void boolean(bool value) {
+        _out.put(static_cast<char>(value ? 0xf5 : 0xf4));
+    }
+    void unsigned_int(uint64_t value) {
+        head_(0, value);
+    }
+    void signed_int(int64_t value) {
+        if (value >= 0) {
+            head_(0, value);
+        } else {
+            head_(1, static_cast<uint64_t>(-1 - value));
+        }
+    }
+    void real(float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        _out.put(static_cast<char>(0xfa));
+        big_endian_(bits, 4);
+    }
+    void real(double value) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        _out.put(static_cast<char>(0xfb));
+        big_endian_(bits, 8);
+    }
+    void text(const char *value, size_t length) {
+        head_(3, length);
+        _out.put(value, length);
+    }
+    void bytes(const uint8_t *value, size_t length) {
+        head_(2, length);
+        _out.put(value, length);
+    }
+
+private:
+    Output& _out;
+
+    void big_endian_(uint64_t value, unsigned bytes) {
+        for (unsigned i = bytes; i > 0; i--) {
+            _out.put(static_cast<char>(value >> (8 * (i - 1))));
+        }
+    }
+    void head_(uint8_t major, uint64_t value) {
+        uint8_t type = major << 5;
+        if (value < 24) {
+            _out.put(static_cast<char>(type | value));
+        } else if (value <= UINT8_MAX) {
+            _out.put(static_cast<char>(type | 24));
+            big_endian_(value, 1);
+        } else if (value <= UINT16_MAX) {
+            _out.put(static_cast<char>(type | 25));
+            big_endian_(value, 2);
+        } else if (value <= UINT32_MAX) {
+            _out.put(static_cast<char>(type | 26));
+            big_endian_(value, 4);
+        } else {
+            _out.put(static_cast<char>(type | 27));
+            big_endian_(value, 8);
+        }
+    }
+};
+
+/* BACnet character strings carry their own charset while JSON and CBOR text
+ * must be UTF-8. Invalid sequences become U+FFFD, and so do the non-ASCII
+ * bytes of DBCS and JIS strings, which would need code page tables. */
+char *put_utf8(char *out, uint32_t code) {
+    if (code > 0x10ffff or (code >= 0xd800 and code <= 0xdfff)) {
+        code = 0xfffd;
+    }
+    if (code < 0x80) {
+        *out++ = code;
+    } else if (code < 0x800) {
+        *out++ = 0xc0 | code >> 6;
+        *out++ = 0x80 | (code & 0x3f);
+    } else if (code < 0x10000) {
+        *out++ = 0xe0 | code >> 12;
+        *out++ = 0x80 | (code >> 6 & 0x3f);
+        *out++ = 0x80 | (code & 0x3f);
+    } else {
+        *out++ = 0xf0 | code >> 18;
+        *out++ = 0x80 | (code >> 12 & 0x3f);
+        *out++ = 0x80 | (code >> 6 & 0x3f);
+        *out++ = 0x80 | (code & 0x3f);
+    }
+    return out;
+}
+
+/* length of the well formed UTF-8 sequence at bytes, 0 if there is none */
+size_t utf8_sequence(const uint8_t *bytes, size_t length) {
+    uint8_t lead = bytes[0];
+    size_t size;
+    uint32_t code, min;
+    if (lead < 0x80) {
+        return 1;
+    } else if ((lead & 0xe0) == 0xc0) {
+        size = 2, code = lead & 0x1f, min = 0x80;
+    } else if ((lead & 0xf0) == 0xe0) {
+        size = 3, code = lead & 0x0f, min = 0x800;
+    } else if ((lead & 0xf8) == 0xf0) {
+        size = 4, code = lead & 0x07, min = 0x10000;
+    } else {
+        return 0;
+    }
+    if (size > length) {
+        return 0;
+    }
+    for (size_t i = 1; i < size; i++) {
+        if ((bytes[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+        code = code << 6 | (bytes[i] & 0x3f);
+    }
+    if (code < min or code > 0x10ffff or (code >= 0xd800 and code <= 0xdfff)) {
+        return 0;
+    }
+    return size;
+}
+
+/* out needs three bytes per input byte, which U+FFFD for a lone byte takes */
+size_t to_utf8(const BACNET_CHARACTER_STRING& string, char *out) {
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(string.value);
+    size_t length = std::min<size_t>(string.length, MAX_CHARACTER_STRING_BYTES);
+    char *end = out;
+    size_t i = 0;
+    while (i < length) {
+        switch (string.encoding) {
+            case CHARACTER_UTF8:
+                if (size_t size = utf8_sequence(in + i, length - i)) {
+                    memcpy(end, in + i, size);
+                    end += size;
+                    i += size;
+                } else {
+                    end = put_utf8(end, 0xfffd);
+                    i++;
+                }
+                break;
+            case CHARACTER_ISO8859:
+                end = put_utf8(end, in[i]);
+                i++;
+                break;
+            case CHARACTER_UCS2:
+                end = put_utf8(end, length - i >= 2 ? in[i] << 8 | in[i + 1] : 0xfffd);
+                i += 2;
+                break;
+            case CHARACTER_UCS4:
+                end = put_utf8(
+                    end, length - i >= 4 ? uint32_t(in[i]) << 24 | in[i + 1] << 16 | in[i + 2] << 8 | in[i + 3] : 0xfffd
+                );
+                i += 4;
+                break;
+            default:
+                end = put_utf8(end, in[i] < 0x80 ? in[i] : 0xfffd);
+                i++;
+                break;
+        }
+    }
+    return end - out;
+}
+
+template <typename Writer>
+void encode_value(Writer& writer, const BACNET_APPLICATION_DATA_VALUE& value) {
+    char text[32];
+    switch (value.tag) {
+        case BACNET_APPLICATION_TAG_BOOLEAN:
+            writer.boolean(value.type.Boolean);
+            break;
+        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+            writer.unsigned_int(value.type.Unsigned_Int);
+            break;
+        case BACNET_APPLICATION_TAG_SIGNED_INT:
+            writer.signed_int(value.type.Signed_Int);
+            break;
+        case BACNET_APPLICATION_TAG_REAL:
+            writer.real(value.type.Real);
+            break;
+        case BACNET_APPLICATION_TAG_DOUBLE:
+            writer.real(value.type.Double);
+            break;
+        case BACNET_APPLICATION_TAG_OCTET_STRING:
+            writer.bytes(value.type.Octet_String.value, value.type.Octet_String.length);
+            break;
+        case BACNET_APPLICATION_TAG_CHARACTER_STRING: {
+            char utf8[MAX_CHARACTER_STRING_BYTES * 3];
+            writer.text(utf8, to_utf8(value.type.Character_String, utf8));
+            break;
+        }
+        case BACNET_APPLICATION_TAG_BIT_STRING: {
+            const BACNET_BIT_STRING& bits = value.type.Bit_String;
+            size_t count = std::min<size_t>(bits.bits_used, MAX_BITSTRING_BYTES * 8);
+            writer.begin_array(count);
+            for (size_t bit = 0; bit < count; bit++) {
+                writer.boolean(bits.value[bit / 8] & (1 << (bit % 8)));
+            }
+            writer.end_array();
+            break;
+        }
+        case BACNET_APPLICATION_TAG_ENUMERATED:
+            writer.unsigned_int(value.type.Enumerated);
+            break;
+        case BACNET_APPLICATION_TAG_DATE: {
+            const BACNET_DATE& date = value.type.Date;
+            int length = snprintf(text, sizeof(text), "%04u-%02u-%02u", date.year, date.month, date.day);
+            writer.text(text, length);
+            break;
+        }
+        case BACNET_APPLICATION_TAG_TIME: {
+            const BACNET_TIME& time = value.type.Time;
+            int length = snprintf(text, sizeof(text), "%02u:%02u:%02u.%02u", time.hour, time.min, time.sec, time.hundredths);
+            writer.text(text, length);
+            break;
+        }
+        case BACNET_APPLICATION_TAG_OBJECT_ID:
+            writer.begin_array(2);
+            writer.unsigned_int(value.type.Object_Id.type);
+            writer.unsigned_int(value.type.Object_Id.instance);
+            writer.end_array();
+            break;
+        default:
+            writer.null();
+            break;
+    }
+}
+
+template <typename Writer>
+void encode(Writer& writer, const BACNET_COV_DATA& data, int64_t timestamp_ms) {
+    size_t count = 0;
+    for (auto *value = data.listOfValues; value != nullptr; value = value->next) {
+        count++;
+    }
+    writer.begin_map(6);
+    writer.key("device");
+    writer.unsigned_int(data.initiatingDeviceIdentifier);
+    writer.key("type");
+    writer.unsigned_int(data.monitoredObjectIdentifier.type);
+    writer.key("instance");
+    writer.unsigned_int(data.monitoredObjectIdentifier.instance);
+    writer.key("time_remaining");
+    writer.unsigned_int(data.timeRemaining);
+    writer.key("timestamp");
+    writer.signed_int(timestamp_ms);
+    writer.key("values");
+    writer.begin_array(count);
+    for (auto *value = data.listOfValues; value != nullptr; value = value->next) {
+        writer.begin_map(3);
+        writer.key("property");
+        writer.unsigned_int(value->propertyIdentifier);
+        writer.key("tag");
+        writer.unsigned_int(value->value.tag);
+        writer.key("value");
+        encode_value(writer, value->value);
+        writer.end_map();
+    }
+    writer.end_array();
+    writer.end_map();
+}
+
+}
+
+bool parse_payload_format(const char *name, payload_format& format) {
+    if (strcmp(name, "text") == 0) {
+        format = payload_format::text;
+    } else if (strcmp(name, "json") == 0) {
+        format = payload_format::json;
+    } else if (strcmp(name, "cbor") == 0) {
+        format = payload_format::cbor;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+size_t encode_notification(
+    payload_format format,
+    const BACNET_COV_DATA& data,
+    int64_t timestamp_ms,
+    char *buffer,
+    size_t size
+) {
+    Output out(buffer, size);
+    if (format == payload_format::json) {
+        JsonWriter writer(out);
+        encode(writer, data, timestamp_ms);
+    } else if (format == payload_format::cbor) {
+        CborWriter writer(out);
+        encode(writer, data, timestamp_ms);
+    }
+    return out.length();
+}
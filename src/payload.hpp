@@ -0,0 +1,36 @@
+#pragma once
+#include <bacnet/bacdef.h>
+#include <bacnet/bacapp.h>
+#include <bacnet/cov.h>
+#include <cstddef>
+#include <cstdint>
+
+enum class payload_format {
+    /* the formatted present value only */
+    text,
+    json,
+    cbor
+};
+
+/* "text", "json" or "cbor" */
+bool parse_payload_format(const char *name, payload_format& format);
+
+/* room for a notification with a few properties and one long string */
+static constexpr size_t payload_buffer_size = 4096;
+
+/* Encodes a whole COV notification as one map
+ *   {device, type, instance, time_remaining, timestamp,
+ *    values: [{property, tag, value}, ...]}
+ * with numeric object type and property identifiers and the timestamp in
+ * milliseconds since the epoch. Values keep their type: numbers, booleans,
+ * strings, octet strings (CBOR bytes or a hex string), bit strings as arrays
+ * of booleans, dates and times as text, object ids as [type, instance].
+ * Writes into buffer without allocating; returns the length or 0 when the
+ * payload does not fit. */
+size_t encode_notification(
+    payload_format format,
+    const BACNET_COV_DATA& data,
+    int64_t timestamp_ms,
+    char *buffer,
+    size_t size
+);
@@ -0,0 +1,112 @@
+#include "pdu_trace.hpp"
+#include <cstring>
+
+namespace {
+
+const char trace_magic[8] = {'B', 'A', 'C', 'P', 'D', 'U', 'T', '1'};
+
+struct record_header {
+    uint64_t time_ns;
+    uint16_t pdu_len;
+    uint16_t net;
+    uint8_t mac_len;
+    uint8_t len;
+};
+/* written field by field, without the padding */
+const size_t record_header_size = 14;
+
+}
+
+PduTraceWriter::~PduTraceWriter() {
+    if (_file) {
+        fclose(_file);
+    }
+}
+
+bool PduTraceWriter::open(const std::string& path) {
+    _file = fopen(path.c_str(), "wb");
+    if (_file == nullptr) {
+        fprintf(stderr, "Unable to open PDU trace %s\n", path.c_str());
+        return false;
+    }
+    setvbuf(_file, nullptr, _IOFBF, 64 * 1024);
+    fwrite(trace_magic, sizeof(trace_magic), 1, _file);
+    return true;
+}
+
+void PduTraceWriter::append(int64_t time_ns, const BACNET_ADDRESS& src, const uint8_t *pdu, uint16_t pdu_len) {
+    if (_file == nullptr) {
+        return;
+    }
+    uint8_t buffer[record_header_size + 2 * MAX_MAC_LEN];
+    uint8_t mac_len = src.mac_len <= MAX_MAC_LEN ? src.mac_len : MAX_MAC_LEN;
+    uint8_t len = src.len <= MAX_MAC_LEN ? src.len : MAX_MAC_LEN;
+    uint64_t time = static_cast<uint64_t>(time_ns);
+    memcpy(buffer, &time, 8);
+    memcpy(buffer + 8, &pdu_len, 2);
+    memcpy(buffer + 10, &src.net, 2);
+    buffer[12] = mac_len;
+    buffer[13] = len;
+    memcpy(buffer + record_header_size, src.mac, mac_len);
+    memcpy(buffer + record_header_size + mac_len, src.adr, len);
+    fwrite(buffer, record_header_size + mac_len + len, 1, _file);
+    fwrite(pdu, pdu_len, 1, _file);
+    _records++;
+}
+
+void PduTraceWriter::flush() {
+    if (_file) {
+        fflush(_file);
+    }
+}
+
+PduTraceReader::~PduTraceReader() {
+    if (_file) {
+        fclose(_file);
+    }
+}
+
+bool PduTraceReader::open(const std::string& path) {
+    _file = fopen(path.c_str(), "rb");
+    if (_file == nullptr) {
+        fprintf(stderr, "Unable to open PDU trace %s\n", path.c_str());
+        return false;
+    }
+    char magic[sizeof(trace_magic)];
+    if (fread(magic, sizeof(magic), 1, _file) != 1 or memcmp(magic, trace_magic, sizeof(magic)) != 0) {
+        fprintf(stderr, "%s is not a PDU trace\n", path.c_str());
+        fclose(_file);
+        _file = nullptr;
+        return false;
+    }
+    return true;
+}
+
+bool PduTraceReader::next(pdu_record& record) {
+    if (_file == nullptr) {
+        return false;
+    }
+    uint8_t buffer[record_header_size];
+    if (fread(buffer, sizeof(buffer), 1, _file) != 1) {
+        return false;
+    }
+    record_header header;
+    memcpy(&header.time_ns, buffer, 8);
+    memcpy(&header.pdu_len, buffer + 8, 2);
+    memcpy(&header.net, buffer + 10, 2);
+    header.mac_len = buffer[12];
+    header.len = buffer[13];
+    if (header.mac_len > MAX_MAC_LEN or header.len > MAX_MAC_LEN or header.pdu_len > MAX_MPDU) {
+        fprintf(stderr, "Corrupt PDU trace record\n");
+        return false;
+    }
+    record = {};
+    record.time_ns = static_cast<int64_t>(header.time_ns);
+    record.src.mac_len = header.mac_len;
+    record.src.net = header.net;
+    record.src.len = header.len;
+    record.pdu_len = header.pdu_len;
+    return (header.mac_len == 0 or fread(record.src.mac, header.mac_len, 1, _file) == 1) and
+        (header.len == 0 or fread(record.src.adr, header.len, 1, _file) == 1) and
+        (header.pdu_len == 0 or fread(record.pdu, header.pdu_len, 1, _file) == 1);
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <bacnet/bacdef.h>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/* one PDU as it was handed to npdu_handler() */
+struct pdu_record {
+    /* system time of the receive in nanoseconds since the epoch */
+    int64_t time_ns;
+    BACNET_ADDRESS src;
+    uint16_t pdu_len;
+    uint8_t pdu[MAX_MPDU];
+};
+
+/* Binary capture of received PDUs. After an 8 byte magic every record is
+ *   u64 time_ns, u16 pdu_len, u16 net, u8 mac_len, u8 len,
+ *   mac[mac_len], adr[len], pdu[pdu_len]
+ * in host byte order, so a typical MS/TP record costs 15 bytes over the PDU.
+ * Writes are buffered, flush() makes them visible. */
+class PduTraceWriter {
+public:
+    PduTraceWriter() = default;
+    ~PduTraceWriter();
+    PduTraceWriter(const PduTraceWriter&) = delete;
+    PduTraceWriter& operator=(const PduTraceWriter&) = delete;
+
+    /* truncates an existing file */
+    bool open(const std::string& path);
+    bool is_open() const {
+        return _file != nullptr;
+    }
+    void append(int64_t time_ns, const BACNET_ADDRESS& src, const uint8_t *pdu, uint16_t pdu_len);
+    void flush();
+    uint64_t records() const {
+        return _records;
+    }
+
+private:
+    FILE *_file = nullptr;
+    uint64_t _records = 0;
+};
+
+class PduTraceReader {
+public:
+    PduTraceReader() = default;
+    ~PduTraceReader();
+    PduTraceReader(const PduTraceReader&) = delete;
+    PduTraceReader& operator=(const PduTraceReader&) = delete;
+
+    bool open(const std::string& path);
+    /* false at the end, a torn last record counts as the end */
+    bool next(pdu_record& record);
+
+private:
+    FILE *_file = nullptr;
+};
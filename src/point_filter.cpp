@@ -0,0 +1,192 @@
+#include "point_filter.hpp"
+#include <bacnet/bactext.h>
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+bool parse_uint(std::string_view text, uint32_t& value) {
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == std::errc() and result.ptr == text.data() + text.size();
+}
+
+/* "12" or "10-20" */
+bool parse_range(std::string_view text, uint32_t& min, uint32_t& max) {
+    size_t dash = text.find('-');
+    if (dash == std::string_view::npos) {
+        if (not parse_uint(text, min)) {
+            return false;
+        }
+        max = min;
+        return true;
+    }
+    return parse_uint(text.substr(0, dash), min) and parse_uint(text.substr(dash + 1), max) and min <= max;
+}
+
+bool parse_types(std::string_view text, std::vector<BACNET_OBJECT_TYPE>& types) {
+    while (not text.empty()) {
+        size_t comma = text.find(',');
+        std::string name(text.substr(0, comma));
+        text = comma == std::string_view::npos ? std::string_view() : text.substr(comma + 1);
+        unsigned type = 0;
+        if (not bactext_object_type_strtol(name.c_str(), &type) or type >= MAX_BACNET_OBJECT_TYPE) {
+            return false;
+        }
+        types.push_back(static_cast<BACNET_OBJECT_TYPE>(type));
+    }
+    return not types.empty();
+}
+
+bool parse_rule(std::string_view line, point_rule& rule) {
+    std::vector<std::string_view> words;
+    while (not line.empty()) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string_view::npos) {
+            break;
+        }
+        size_t end = line.find_first_of(" \t\r", start);
+        words.push_back(line.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start));
+        line = end == std::string_view::npos ? std::string_view() : line.substr(end);
+    }
+    if (words.empty()) {
+        return false;
+    }
+    if (words[0] == "include") {
+        rule.action = rule_action::include;
+    } else if (words[0] == "exclude") {
+        rule.action = rule_action::exclude;
+    } else if (words[0] == "cov") {
+        rule.action = rule_action::cov;
+    } else {
+        return false;
+    }
+    for (size_t i = 1; i < words.size(); i++) {
+        size_t equals = words[i].find('=');
+        if (equals == std::string_view::npos) {
+            return false;
+        }
+        std::string_view key = words[i].substr(0, equals);
+        std::string_view value = words[i].substr(equals + 1);
+        bool valid;
+        if (key == "device") {
+            valid = parse_range(value, rule.device_min, rule.device_max);
+        } else if (key == "type") {
+            valid = parse_types(value, rule.types);
+        } else if (key == "instance") {
+            valid = parse_range(value, rule.instance_min, rule.instance_max);
+        } else if (key == "increment" and rule.action == rule_action::cov) {
+            auto result = std::from_chars(value.data(), value.data() + value.size(), rule.cov_increment);
+            valid = result.ec == std::errc() and result.ptr == value.data() + value.size() and rule.cov_increment > 0;
+        } else {
+            valid = false;
+        }
+        if (not valid) {
+            return false;
+        }
+    }
+    return rule.action != rule_action::cov or rule.cov_increment > 0;
+}
+
+}
+
+bool PointFilter::load(const std::string& path) {
+    std::ifstream file(path);
+    if (not file) {
+        fprintf(stderr, "Unable to read point selection %s\n", path.c_str());
+        return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    std::string error;
+    if (not parse(text.str(), error)) {
+        fprintf(stderr, "Invalid point selection rule in %s: %s\n", path.c_str(), error.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool PointFilter::parse(std::string_view text, std::string& error) {
+    std::vector<point_rule> rules;
+    while (not text.empty()) {
+        size_t newline = text.find('\n');
+        std::string_view line = text.substr(0, newline);
+        text = newline == std::string_view::npos ? std::string_view() : text.substr(newline + 1);
+        line = line.substr(0, line.find('#'));
+        if (line.find_first_not_of(" \t\r") == std::string_view::npos) {
+            continue;
+        }
+        point_rule rule;
+        if (not parse_rule(line, rule) or rules.size() == UINT16_MAX) {
+            error = line;
+            return false;
+        }
+        rules.push_back(std::move(rule));
+    }
+    _rules = std::move(rules);
+    compile_();
+    return true;
+}
+
+void PointFilter::compile_() {
+    _default_include = std::none_of(_rules.begin(), _rules.end(), [](const point_rule& rule) {
+        return rule.action == rule_action::include;
+    });
+    _any_type.clear();
+    unsigned type_count = 0;
+    for (const auto& rule: _rules) {
+        for (auto type: rule.types) {
+            type_count = std::max(type_count, static_cast<unsigned>(type) + 1);
+        }
+    }
+    _by_type.assign(type_count, {});
+    for (uint16_t index = 0; index < _rules.size(); index++) {
+        const auto& rule = _rules[index];
+        if (rule.types.empty()) {
+            _any_type.push_back(index);
+            for (auto& list: _by_type) {
+                list.push_back(index);
+            }
+            continue;
+        }
+        for (auto type: rule.types) {
+            auto& list = _by_type[type];
+            /* a type listed twice in one rule */
+            if (list.empty() or list.back() != index) {
+                list.push_back(index);
+            }
+        }
+    }
+}
+
+template <typename Predicate>
+const point_rule *PointFilter::last_match_(uint32_t device_id, const BACNET_OBJECT_ID& object, Predicate predicate) const {
+    const auto& candidates = static_cast<size_t>(object.type) < _by_type.size() ? _by_type[object.type] : _any_type;
+    for (auto index = candidates.rbegin(); index != candidates.rend(); ++index) {
+        const auto& rule = _rules[*index];
+        if (
+            predicate(rule) and
+            device_id >= rule.device_min and device_id <= rule.device_max and
+            object.instance >= rule.instance_min and object.instance <= rule.instance_max
+        ) {
+            return &rule;
+        }
+    }
+    return nullptr;
+}
+
+bool PointFilter::selected(uint32_t device_id, const BACNET_OBJECT_ID& object) const {
+    const point_rule *rule = last_match_(device_id, object, [](const point_rule& rule) {
+        return rule.action != rule_action::cov;
+    });
+    return rule ? rule->action == rule_action::include : _default_include;
+}
+
+float PointFilter::cov_increment(uint32_t device_id, const BACNET_OBJECT_ID& object) const {
+    const point_rule *rule = last_match_(device_id, object, [](const point_rule& rule) {
+        return rule.action == rule_action::cov;
+    });
+    return rule ? rule->cov_increment : 0;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <bacnet/bacdef.h>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class rule_action {
+    include,
+    exclude,
+    /* only sets the COV increment, takes no part in the selection */
+    cov
+};
+
+struct point_rule {
+    rule_action action;
+    uint32_t device_min = 0;
+    uint32_t device_max = BACNET_MAX_INSTANCE;
+    /* empty for every object type */
+    std::vector<BACNET_OBJECT_TYPE> types;
+    uint32_t instance_min = 0;
+    uint32_t instance_max = BACNET_MAX_INSTANCE;
+    float cov_increment = 0;
+};
+
+/* Decides which points are subscribed or polled. The rules come from a file
+ * with one rule per line, '#' starts a comment:
+ *
+ *   include device=1000-1999 type=analog-input,analog-value instance=0-99
+ *   exclude type=file,schedule,notification-class
+ *   cov type=analog-input increment=0.5
+ *
+ * device and instance take a number or a range, type object type names or
+ * numbers; a missing field matches everything. The last matching rule wins.
+ * A point no rule matches is selected unless the file has include rules.
+ * cov rules set the COV increment the present value is subscribed with,
+ * again the last matching one wins.
+ *
+ * The rules are compiled into one list per object type, so a lookup only
+ * looks at the rules which can match that type. */
+class PointFilter {
+public:
+    /* keeps the current rules and returns false when the file is invalid */
+    bool load(const std::string& path);
+    /* error gets the line which could not be parsed */
+    bool parse(std::string_view text, std::string& error);
+    bool selected(uint32_t device_id, const BACNET_OBJECT_ID& object) const;
+    /* 0 when no cov rule matches, the device's own increment applies then */
+    float cov_increment(uint32_t device_id, const BACNET_OBJECT_ID& object) const;
+    size_t size() const {
+        return _rules.size();
+    }
+
+private:
+    std::vector<point_rule> _rules;
+    bool _default_include = true;
+    /* indexes into _rules per object type, types beyond use _any_type */
+    std::vector<std::vector<uint16_t>> _by_type;
+    std::vector<uint16_t> _any_type;
+
+    void compile_();
+    /* last rule for the point which satisfies the predicate, or nullptr */
+    template <typename Predicate>
+    const point_rule *last_match_(uint32_t device_id, const BACNET_OBJECT_ID& object, Predicate predicate) const;
+};
@@ -0,0 +1,92 @@
+#include "point_table.hpp"
+#include <bacnet/bactext.h>
+
+namespace {
+
+/* splitmix64 finalizer, every key bit affects every hash bit */
+uint64_t mix(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+}
+
+void PointTable::set_topic_prefix(const std::string& prefix) {
+    _topic_prefix = prefix;
+}
+
+point_id PointTable::find(uint64_t key) const {
+    if (_slot_ids.empty()) {
+        return invalid_point;
+    }
+    size_t mask = _slot_ids.size() - 1;
+    for (size_t slot = mix(key) & mask;; slot = (slot + 1) & mask) {
+        if (_slot_ids[slot] == invalid_point) {
+            return invalid_point;
+        }
+        if (_slot_keys[slot] == key) {
+            return _slot_ids[slot];
+        }
+    }
+}
+
+point_id PointTable::find(uint32_t device_id, const BACNET_OBJECT_ID& object) const {
+    return find(point_key(device_id, object));
+}
+
+void PointTable::grow_() {
+    size_t capacity = _slot_ids.empty() ? 64 : _slot_ids.size() * 2;
+    _slot_keys.assign(capacity, 0);
+    _slot_ids.assign(capacity, invalid_point);
+    size_t mask = capacity - 1;
+    for (point_id id = 0; id < _records.size(); id++) {
+        uint64_t key = point_key(_records[id].device_id, _records[id].object);
+        size_t slot = mix(key) & mask;
+        while (_slot_ids[slot] != invalid_point) {
+            slot = (slot + 1) & mask;
+        }
+        _slot_keys[slot] = key;
+        _slot_ids[slot] = id;
+    }
+}
+
+point_id PointTable::intern(uint32_t device_id, const BACNET_OBJECT_ID& object) {
+    uint64_t key = point_key(device_id, object);
+    point_id id = find(key);
+    if (id != invalid_point) {
+        return id;
+    }
+    id = static_cast<point_id>(_records.size());
+    _records.push_back({
+        .device_id = device_id,
+        .object = object,
+        .topic = _topic_prefix + std::to_string(device_id) + "/" +
+            bactext_object_type_name(object.type) + "/" + std::to_string(object.instance)
+    });
+    tag.push_back(0);
+    flags.push_back(0);
+    renew_at.emplace_back();
+    subscribe_end.emplace_back();
+    value_hash.push_back(0);
+    value.emplace_back();
+    updated_at.emplace_back();
+    status_flags.push_back(0);
+    notifications.push_back(0);
+    cov_increment.push_back(0);
+    if (_records.size() * 2 > _slot_ids.size()) {
+        grow_();
+    } else {
+        size_t mask = _slot_ids.size() - 1;
+        size_t slot = mix(key) & mask;
+        while (_slot_ids[slot] != invalid_point) {
+            slot = (slot + 1) & mask;
+        }
+        _slot_keys[slot] = key;
+        _slot_ids[slot] = id;
+    }
+    return id;
+}
@@ -0,0 +1,87 @@
+#pragma once
+#include <bacnet/bacdef.h>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+typedef uint32_t point_id;
+static constexpr point_id invalid_point = UINT32_MAX;
+
+enum point_flag : uint8_t {
+    POINT_SUBSCRIBE_PENDING = 1 << 0,
+    /* COV rejected, the value is polled instead */
+    POINT_POLLED = 1 << 1,
+    POINT_HAS_VALUE = 1 << 2,
+    /* on demand ReadProperty outstanding, later requests wait for it */
+    POINT_READ_PENDING = 1 << 3,
+    /* left out by the point selection, neither subscribed nor polled */
+    POINT_EXCLUDED = 1 << 4,
+    /* unconfirmed COV: subscribed, the initial notification has not arrived */
+    POINT_AWAITING_NOTIFICATION = 1 << 5,
+    /* present value read after a lost notification outstanding */
+    POINT_RESYNC_PENDING = 1 << 6,
+    /* polled while the device has no free COV subscription slot, the
+     * subscription is retried at the renewal time */
+    POINT_COV_RETRY = 1 << 7,
+};
+
+/* device id in the upper half, BACnet encoded object identifier below */
+inline uint64_t point_key(uint32_t device_id, const BACNET_OBJECT_ID& object) {
+    return (static_cast<uint64_t>(device_id) << 32) |
+        (static_cast<uint64_t>(object.type) << 22) |
+        (object.instance & BACNET_MAX_INSTANCE);
+}
+
+/* Dense table of every known point. Points are interned once and keep their
+ * id for the lifetime of the process; the hot per-point state lives in
+ * parallel arrays indexed by point id, the cold description (device, object,
+ * MQTT topic) in a separate record array. Lookup by key goes through an open
+ * addressing index on the mixed 64 bit key. */
+class PointTable {
+public:
+    typedef std::chrono::steady_clock clock;
+    struct record {
+        uint32_t device_id;
+        BACNET_OBJECT_ID object;
+        std::string topic;
+    };
+
+    void set_topic_prefix(const std::string& prefix);
+    point_id find(uint32_t device_id, const BACNET_OBJECT_ID& object) const;
+    point_id find(uint64_t key) const;
+    /* returns the existing id or adds the point */
+    point_id intern(uint32_t device_id, const BACNET_OBJECT_ID& object);
+    size_t size() const {
+        return _records.size();
+    }
+    const record& info(point_id id) const {
+        return _records[id];
+    }
+
+    /* hot fields, struct of arrays */
+    std::vector<uint8_t> tag;
+    std::vector<uint8_t> flags;
+    std::vector<clock::time_point> renew_at;
+    std::vector<clock::time_point> subscribe_end;
+    std::vector<uint64_t> value_hash;
+    /* last value cache, valid with POINT_HAS_VALUE; status flags use the
+     * BACnet bit numbers */
+    std::vector<std::string> value;
+    std::vector<clock::time_point> updated_at;
+    std::vector<uint8_t> status_flags;
+    /* notifications and changed polled values, for the metrics */
+    std::vector<uint64_t> notifications;
+    /* SubscribeCOVProperty increment for the present value, 0 for a plain
+     * SubscribeCOV with the device's own increment */
+    std::vector<float> cov_increment;
+
+private:
+    std::string _topic_prefix = "bacnet-out/";
+    std::vector<record> _records;
+    /* open addressing, power of two sized, at most half full */
+    std::vector<uint64_t> _slot_keys;
+    std::vector<point_id> _slot_ids;
+
+    void grow_();
+};
@@ -0,0 +1,157 @@
+#include "poller.hpp"
+#include <algorithm>
+
+void PointPoller::configure(std::chrono::milliseconds min_interval, std::chrono::milliseconds max_interval) {
+    _min_interval = min_interval;
+    _max_interval = std::max(max_interval, min_interval);
+}
+
+PointPoller::poll_point *PointPoller::find_(uint32_t device_id, const BACNET_OBJECT_ID& object) {
+    auto device_it = _devices.find(device_id);
+    if (device_it == _devices.end()) {
+        return nullptr;
+    }
+    for (auto& point: device_it->second.points) {
+        if (point.object.type == object.type and point.object.instance == object.instance) {
+            return &point;
+        }
+    }
+    return nullptr;
+}
+
+void PointPoller::reschedule_(uint32_t device_id, poll_device& device) {
+    auto next = clock::time_point::max();
+    for (const auto& point: device.points) {
+        if (not point.in_flight) {
+            next = std::min(next, point.due);
+        }
+    }
+    /* one live heap entry per device, older ones are skipped when popped */
+    if (next != clock::time_point::max() and next != device.scheduled) {
+        device.scheduled = next;
+        _schedule.schedule(device_id, next);
+    }
+}
+
+void PointPoller::add(uint32_t device_id, const BACNET_OBJECT_ID& object) {
+    if (find_(device_id, object)) {
+        return;
+    }
+    auto& device = _devices[device_id];
+    device.points.push_back({.object = object, .interval = _min_interval, .due = clock::now(), .in_flight = false});
+    reschedule_(device_id, device);
+}
+
+void PointPoller::remove(uint32_t device_id, const BACNET_OBJECT_ID& object) {
+    auto device_it = _devices.find(device_id);
+    if (device_it == _devices.end()) {
+        return;
+    }
+    auto& points = device_it->second.points;
+    std::erase_if(points, [&object](const poll_point& point) {
+        return point.object.type == object.type and point.object.instance == object.instance;
+    });
+    if (points.empty()) {
+        _devices.erase(device_it);
+    }
+}
+
+bool PointPoller::contains(uint32_t device_id, const BACNET_OBJECT_ID& object) const {
+    return const_cast<PointPoller *>(this)->find_(device_id, object) != nullptr;
+}
+
+void PointPoller::set_batch_size(uint32_t device_id, unsigned batch_size) {
+    auto device_it = _devices.find(device_id);
+    if (device_it != _devices.end()) {
+        device_it->second.batch_size = std::max(batch_size, 1u);
+    }
+}
+
+unsigned PointPoller::batch_size(uint32_t device_id) const {
+    auto device_it = _devices.find(device_id);
+    return device_it == _devices.end() ? 1 : device_it->second.batch_size;
+}
+
+void PointPoller::polled(uint32_t device_id, const BACNET_OBJECT_ID& object, bool changed) {
+    auto *point = find_(device_id, object);
+    if (point == nullptr) {
+        return;
+    }
+    point->interval = changed ? _min_interval : std::min(point->interval * 2, _max_interval);
+    point->due = clock::now() + point->interval;
+    point->in_flight = false;
+    reschedule_(device_id, _devices[device_id]);
+}
+
+void PointPoller::failed(uint32_t device_id, const std::vector<BACNET_OBJECT_ID>& objects) {
+    auto device_it = _devices.find(device_id);
+    if (device_it == _devices.end()) {
+        return;
+    }
+    for (const auto& object: objects) {
+        auto *point = find_(device_id, object);
+        if (point and point->in_flight) {
+            point->due = clock::now() + point->interval;
+            point->in_flight = false;
+        }
+    }
+    reschedule_(device_id, device_it->second);
+}
+
+long PointPoller::task(const send_handler& send) {
+    auto now = clock::now();
+    std::vector<uint32_t> due_devices;
+    _schedule.pop_due(now, [this, &due_devices](uint32_t device_id, clock::time_point scheduled) {
+        auto device_it = _devices.find(device_id);
+        if (device_it != _devices.end() and device_it->second.scheduled == scheduled) {
+            due_devices.push_back(device_id);
+        }
+    });
+    for (uint32_t device_id: due_devices) {
+        auto& device = _devices[device_id];
+        device.scheduled = clock::time_point();
+        std::vector<poll_point *> candidates;
+        size_t due_count = 0;
+        for (auto& point: device.points) {
+            if (point.in_flight or point.due > now + _min_interval) {
+                continue;
+            }
+            due_count += point.due <= now;
+            candidates.push_back(&point);
+        }
+        std::sort(candidates.begin(), candidates.end(), [](const poll_point *lhs, const poll_point *rhs) {
+            return lhs->due < rhs->due;
+        });
+        /* as many batches as needed for the due points, topped up with the
+         * ones due soon */
+        size_t batches = (due_count + device.batch_size - 1) / device.batch_size;
+        candidates.resize(std::min(candidates.size(), batches * device.batch_size));
+        std::vector<BACNET_OBJECT_ID> objects;
+        for (size_t first = 0; first < candidates.size(); first += device.batch_size) {
+            objects.clear();
+            size_t last = std::min(candidates.size(), first + device.batch_size);
+            for (size_t i = first; i < last; i++) {
+                objects.push_back(candidates[i]->object);
+            }
+            if (not send(device_id, objects)) {
+                for (size_t i = first; i < candidates.size(); i++) {
+                    candidates[i]->due = now + _min_interval;
+                }
+                break;
+            }
+            for (size_t i = first; i < last; i++) {
+                candidates[i]->in_flight = true;
+            }
+        }
+        reschedule_(device_id, device);
+    }
+    return _schedule.remaining_ms(clock::now());
+}
+
+size_t PointPoller::size() const {
+    size_t count = 0;
+    for (const auto& [device_id, device]: _devices) {
+        count += device.points.size();
+    }
+    return count;
+}
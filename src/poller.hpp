@@ -0,0 +1,54 @@
+#pragma once
+#include "deadline_queue.hpp"
+#include <bacnet/bacdef.h>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+/* Polling fallback for objects that can not be subscribed. Points are kept
+ * per device and due points are sent in batches of up to batch_size objects
+ * per request; points due within the next min_interval are pulled forward to
+ * fill a batch. Each point polls at min_interval after a change and backs off
+ * towards max_interval while its value is static. */
+class PointPoller {
+public:
+    typedef std::chrono::steady_clock clock;
+    /* sends one request for the objects, returns false if it was not queued */
+    typedef std::function<bool(uint32_t, const std::vector<BACNET_OBJECT_ID>&)> send_handler;
+
+    void configure(std::chrono::milliseconds min_interval, std::chrono::milliseconds max_interval);
+    void add(uint32_t device_id, const BACNET_OBJECT_ID& object);
+    void remove(uint32_t device_id, const BACNET_OBJECT_ID& object);
+    bool contains(uint32_t device_id, const BACNET_OBJECT_ID& object) const;
+    void set_batch_size(uint32_t device_id, unsigned batch_size);
+    unsigned batch_size(uint32_t device_id) const;
+    /* result of a poll; changed shortens the interval, unchanged doubles it */
+    void polled(uint32_t device_id, const BACNET_OBJECT_ID& object, bool changed);
+    /* the request for these objects failed, try again at their interval */
+    void failed(uint32_t device_id, const std::vector<BACNET_OBJECT_ID>& objects);
+    /* sends due batches, returns ms until the next one or -1 */
+    long task(const send_handler& send);
+    size_t size() const;
+
+private:
+    struct poll_point {
+        BACNET_OBJECT_ID object;
+        clock::duration interval;
+        clock::time_point due;
+        bool in_flight;
+    };
+    struct poll_device {
+        std::vector<poll_point> points;
+        unsigned batch_size = 1;
+        clock::time_point scheduled;
+    };
+    clock::duration _min_interval = std::chrono::seconds(5);
+    clock::duration _max_interval = std::chrono::seconds(60);
+    std::unordered_map<uint32_t, poll_device> _devices;
+    DeadlineQueue<uint32_t> _schedule;
+
+    poll_point *find_(uint32_t device_id, const BACNET_OBJECT_ID& object);
+    void reschedule_(uint32_t device_id, poll_device& device);
+};
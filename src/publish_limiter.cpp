@@ -0,0 +1,203 @@
+#include "publish_limiter.hpp"
+#include <bacnet/bactext.h>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+
+namespace {
+
+bool parse_number(std::string_view text, double& number) {
+    if (text.empty()) {
+        return false;
+    }
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), number);
+    return ec == std::errc() and end == text.data() + text.size();
+}
+
+bool parse_object_type(std::string_view text, BACNET_OBJECT_TYPE& type) {
+    unsigned value = 0;
+    if (not bactext_object_type_strtol(std::string(text).c_str(), &value)) {
+        return false;
+    }
+    type = static_cast<BACNET_OBJECT_TYPE>(value);
+    return true;
+}
+
+}
+
+PublishLimiter::PublishLimiter(const PointTable& points, publish_function publish, congested_function congested, void *context)
+    : _points(points)
+    , _publish(publish)
+    , _congested(congested)
+    , _context(context)
+{
+}
+
+bool PublishLimiter::parse_rule_(std::string_view rule) {
+    size_t colon = rule.find(':');
+    if (colon == std::string_view::npos) {
+        return false;
+    }
+    std::string_view selector = rule.substr(0, colon);
+    publish_policy policy;
+    for (std::string_view options = rule.substr(colon + 1); not options.empty();) {
+        size_t comma = options.find(',');
+        std::string_view option = options.substr(0, comma);
+        options = comma == std::string_view::npos ? std::string_view() : options.substr(comma + 1);
+        size_t equals = option.find('=');
+        double number = 0;
+        if (equals == std::string_view::npos or not parse_number(option.substr(equals + 1), number) or number < 0) {
+            return false;
+        }
+        std::string_view name = option.substr(0, equals);
+        if (name == "deadband") {
+            policy.deadband = number;
+        } else if (name == "percent") {
+            policy.deadband_percent = number;
+        } else if (name == "interval") {
+            policy.min_interval = std::chrono::milliseconds(static_cast<long>(number));
+        } else {
+            return false;
+        }
+    }
+
+    if (selector == "default") {
+        _policies[0] = policy;
+        return true;
+    }
+    uint16_t index = static_cast<uint16_t>(_policies.size());
+    size_t slash = selector.find('/');
+    if (slash == std::string_view::npos) {
+        BACNET_OBJECT_TYPE type;
+        if (not parse_object_type(selector, type)) {
+            return false;
+        }
+        _policies.push_back(policy);
+        _type_policies[type] = index;
+        return true;
+    }
+    size_t second = selector.find('/', slash + 1);
+    double device_id = 0;
+    double instance = 0;
+    BACNET_OBJECT_TYPE type;
+    if (second == std::string_view::npos or
+            not parse_number(selector.substr(0, slash), device_id) or
+            not parse_object_type(selector.substr(slash + 1, second - slash - 1), type) or
+            not parse_number(selector.substr(second + 1), instance)) {
+        return false;
+    }
+    BACNET_OBJECT_ID object = {.type = type, .instance = static_cast<uint32_t>(instance)};
+    _policies.push_back(policy);
+    _point_policies[point_key(static_cast<uint32_t>(device_id), object)] = index;
+    return true;
+}
+
+bool PublishLimiter::configure(const std::string& rules) {
+    std::string_view remaining = rules;
+    while (not remaining.empty()) {
+        size_t separator = remaining.find(';');
+        std::string_view rule = remaining.substr(0, separator);
+        remaining = separator == std::string_view::npos ? std::string_view() : remaining.substr(separator + 1);
+        if (not rule.empty() and not parse_rule_(rule)) {
+            return false;
+        }
+    }
+    for (auto& state: _states) {
+        state.resolved = false;
+    }
+    return true;
+}
+
+PublishLimiter::point_state& PublishLimiter::state_(point_id point) {
+    if (point >= _states.size()) {
+        _states.resize(_points.size());
+    }
+    auto& state = _states[point];
+    if (not state.resolved) {
+        const auto& info = _points.info(point);
+        auto point_it = _point_policies.find(point_key(info.device_id, info.object));
+        auto type_it = _type_policies.find(info.object.type);
+        state.policy = point_it != _point_policies.end() ? point_it->second :
+            type_it != _type_policies.end() ? type_it->second : 0;
+        state.resolved = true;
+    }
+    return state;
+}
+
+void PublishLimiter::publish_(point_id point, point_state& state, std::string_view value, clock::time_point now) {
+    _publish(_context, point, _points.info(point).topic, value);
+    state.last_publish = now;
+    if (state.numeric) {
+        state.last_number = state.number;
+        state.has_published = true;
+    }
+    _stats.published++;
+}
+
+void PublishLimiter::offer(point_id point, std::string_view value) {
+    auto& state = state_(point);
+    const auto& policy = _policies[state.policy];
+    _stats.offered++;
+    /* the deadband applies to the present value in the cache, the payload
+     * may be a whole structured notification */
+    double number = 0;
+    bool numeric = parse_number(_points.value[point], number);
+    if (state.has_published and (policy.deadband > 0 or policy.deadband_percent > 0) and numeric) {
+        double threshold = std::max(policy.deadband, std::fabs(state.last_number) * policy.deadband_percent / 100);
+        if (std::fabs(number - state.last_number) < threshold) {
+            /* back within the band of what the subscribers last saw */
+            if (state.pending) {
+                state.pending = false;
+                _stats.pending--;
+            }
+            _stats.suppressed++;
+            return;
+        }
+    }
+
+    /* of the newest value, which is the one published next */
+    state.number = number;
+    state.numeric = numeric;
+    auto now = clock::now();
+    auto due = state.last_publish + policy.min_interval;
+    if (state.pending) {
+        state.pending_value.assign(value);
+        _stats.conflated++;
+        return;
+    }
+    if (due <= now and not _congested(_context)) {
+        publish_(point, state, value, now);
+        return;
+    }
+    /* the slot's string keeps its capacity, steady state does not allocate */
+    state.pending_value.assign(value);
+    state.pending = true;
+    _stats.pending++;
+    _stats.deferred++;
+    _due.schedule(point, std::max(due, now));
+}
+
+long PublishLimiter::flush() {
+    auto now = clock::now();
+    while (not _congested(_context)) {
+        size_t popped = _due.pop_due(now, [this, now](point_id point, clock::time_point) {
+            auto& state = _states[point];
+            /* entries of a slot that was cleared and refilled are stale */
+            if (not state.pending or state.last_publish + _policies[state.policy].min_interval > now) {
+                return;
+            }
+            state.pending = false;
+            _stats.pending--;
+            publish_(point, state, state.pending_value, now);
+        }, 1);
+        if (popped == 0) {
+            return _due.remaining_ms(now);
+        }
+    }
+    /* woken by the socket becoming writable, the timeout covers a dead link */
+    return _due.empty() ? -1 : 100;
+}
+
+publish_limiter_stats PublishLimiter::stats() const {
+    return _stats;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "deadline_queue.hpp"
+#include "point_table.hpp"
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+struct publish_policy {
+    /* numeric values closer than max(deadband, deadband_percent of the last
+     * published value) to the last published value are dropped */
+    double deadband = 0;
+    double deadband_percent = 0;
+    /* at most one publish per interval, newer values replace the pending one */
+    std::chrono::milliseconds min_interval{0};
+};
+
+struct publish_limiter_stats {
+    uint64_t offered;
+    uint64_t published;
+    uint64_t suppressed;
+    uint64_t conflated;
+    uint64_t deferred;
+    size_t pending;
+};
+
+/* Applies the publish policies between the BACnet side and MQTT. Every point
+ * has a single pending slot: while a point is rate limited or the broker
+ * connection is congested only its newest value is kept, so memory does not
+ * grow with the size of a burst.
+ *
+ * Policies are configured with a string of ';' separated rules
+ *   <selector>:<option>=<value>[,<option>=<value>...]
+ * where the selector is "default", an object type name (analog-input) or a
+ * single point (<device>/<object type>/<instance>) and the options are
+ * deadband, percent and interval (milliseconds). Point rules win over type
+ * rules which win over the default. */
+class PublishLimiter {
+public:
+    typedef std::chrono::steady_clock clock;
+    typedef void (*publish_function)(void *context, point_id point, const std::string& topic, std::string_view value);
+    typedef bool (*congested_function)(void *context);
+
+    PublishLimiter(const PointTable& points, publish_function publish, congested_function congested, void *context);
+    bool configure(const std::string& rules);
+    void offer(point_id point, std::string_view value);
+    /* publishes the pending values that are due, returns ms until the next
+     * one or -1 */
+    long flush();
+    publish_limiter_stats stats() const;
+
+private:
+    struct point_state {
+        uint16_t policy;
+        bool resolved;
+        bool has_published;
+        bool pending;
+        bool numeric;
+        double number;
+        double last_number;
+        clock::time_point last_publish;
+        std::string pending_value;
+    };
+    const PointTable& _points;
+    publish_function _publish;
+    congested_function _congested;
+    void *_context;
+    std::vector<publish_policy> _policies{publish_policy{}};
+    std::unordered_map<uint32_t, uint16_t> _type_policies;
+    std::unordered_map<uint64_t, uint16_t> _point_policies;
+    std::vector<point_state> _states;
+    DeadlineQueue<point_id> _due;
+    publish_limiter_stats _stats = {};
+
+    point_state& state_(point_id point);
+    bool parse_rule_(std::string_view rule);
+    void publish_(point_id point, point_state& state, std::string_view value, clock::time_point now);
+};
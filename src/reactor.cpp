@@ -0,0 +1,100 @@
+#include "reactor.hpp"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+Reactor::Reactor() {
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (_epoll_fd < 0 or _timer_fd < 0) {
+        std::cerr << "reactor init error: " << strerror(errno) << std::endl;
+        exit(-1);
+    }
+    add(_timer_fd, EPOLLIN, [this](uint32_t) {
+        uint64_t expirations;
+        (void)!read(_timer_fd, &expirations, sizeof(expirations));
+    });
+}
+
+Reactor::~Reactor() {
+    close(_timer_fd);
+    close(_epoll_fd);
+}
+
+void Reactor::add(int fd, uint32_t events, fd_handler handler) {
+    struct epoll_event event = {.events = events, .data = {.fd = fd}};
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        std::cerr << "epoll add error for fd " << fd << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    _handlers[fd] = std::move(handler);
+}
+
+void Reactor::modify(int fd, uint32_t events) {
+    struct epoll_event event = {.events = events, .data = {.fd = fd}};
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+        std::cerr << "epoll modify error for fd " << fd << ": " << strerror(errno) << std::endl;
+    }
+}
+
+void Reactor::remove(int fd) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+    _handlers.erase(fd);
+}
+
+void Reactor::add_prepare(prepare_handler handler) {
+    _prepare.push_back(std::move(handler));
+}
+
+void Reactor::arm_timer_(int timeout_ms) {
+    struct itimerspec spec = {};
+    if (timeout_ms == 0) {
+        /* zero disarms a timerfd, fire as soon as possible instead */
+        spec.it_value.tv_nsec = 1;
+    } else if (timeout_ms > 0) {
+        spec.it_value.tv_sec = timeout_ms / 1000;
+        spec.it_value.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    }
+    timerfd_settime(_timer_fd, 0, &spec, nullptr);
+}
+
+void Reactor::run_once() {
+    int timeout_ms = -1;
+    for (const auto& prepare: _prepare) {
+        int deadline = prepare();
+        if (deadline >= 0 and (timeout_ms < 0 or deadline < timeout_ms)) {
+            timeout_ms = deadline;
+        }
+    }
+    arm_timer_(timeout_ms);
+
+    struct epoll_event events[16];
+    int count = epoll_wait(_epoll_fd, events, 16, -1);
+    if (count < 0) {
+        if (errno != EINTR) {
+            std::cerr << "epoll wait error: " << strerror(errno) << std::endl;
+        }
+        return;
+    }
+    for (int i = 0; i < count; i++) {
+        auto handler_it = _handlers.find(events[i].data.fd);
+        if (handler_it != _handlers.end()) {
+            /* copy, the handler may remove itself */
+            auto handler = handler_it->second;
+            handler(events[i].events);
+        }
+    }
+}
+
+void Reactor::run() {
+    _stopped = false;
+    while (not _stopped) {
+        run_once();
+    }
+}
+
+void Reactor::stop() {
+    _stopped = true;
+}
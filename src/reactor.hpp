@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+
+/* Single threaded event loop. Waits on registered file descriptors and on the
+ * earliest deadline requested by the prepare callbacks (armed on a timerfd),
+ * so work is done as soon as a frame, a message or a timer is due. */
+class Reactor {
+public:
+    typedef std::function<void(uint32_t)> fd_handler;
+    /* called before every wait, returns milliseconds until the next deadline
+     * of the caller or -1 if it has none */
+    typedef std::function<int()> prepare_handler;
+
+    Reactor();
+    ~Reactor();
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    void add(int fd, uint32_t events, fd_handler handler);
+    void modify(int fd, uint32_t events);
+    void remove(int fd);
+    void add_prepare(prepare_handler handler);
+    void run_once();
+    void run();
+    void stop();
+
+private:
+    int _epoll_fd = -1;
+    int _timer_fd = -1;
+    bool _stopped = false;
+    std::unordered_map<int, fd_handler> _handlers;
+    std::vector<prepare_handler> _prepare;
+    void arm_timer_(int timeout_ms);
+};
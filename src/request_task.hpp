@@ -0,0 +1,74 @@
+#pragma once
+#include "pacer.hpp"
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <utility>
+
+/* Fire and forget coroutine for request flows on the BACnet thread. It runs
+ * right away up to its first co_await and frees itself when it returns, so
+ * many of them interleave on the bus without threads or locks. */
+struct request_task {
+    struct promise_type {
+        request_task get_return_object() noexcept {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+            std::terminate();
+        }
+    };
+};
+
+/* co_await on a confirmed request submitted to the pacer, resumed from its
+ * done callback with the final outcome, retries included. send and sent are
+ * like in paced_request; sent gets the reply so the ack and error handlers
+ * can fill it in by invoke id. The awaitable lives in the suspended
+ * coroutine's frame until it resumes. */
+template <typename Reply>
+class paced_awaitable {
+public:
+    paced_awaitable(
+        RequestPacer& pacer, uint32_t device_id, std::function<uint8_t()> send, std::function<void(uint8_t, Reply&)> sent
+    ):
+        _pacer(pacer), _device_id(device_id), _send(std::move(send)), _sent(std::move(sent)) {}
+    paced_awaitable(const paced_awaitable&) = delete;
+    paced_awaitable& operator=(const paced_awaitable&) = delete;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+        /* the pacer calls neither back from submit() */
+        _pacer.submit({
+            .device_id = _device_id,
+            .send = _send,
+            .done = [this, handle](request_result result) {
+                _reply.result = result;
+                handle.resume();
+            },
+            .sent = [this](uint8_t invoke_id) {
+                _sent(invoke_id, _reply);
+            }
+        });
+    }
+
+    Reply await_resume() {
+        return std::move(_reply);
+    }
+
+private:
+    RequestPacer& _pacer;
+    uint32_t _device_id;
+    std::function<uint8_t()> _send;
+    std::function<void(uint8_t, Reply&)> _sent;
+    Reply _reply = {};
+};
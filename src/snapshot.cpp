@@ -0,0 +1,182 @@
+#include "snapshot.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char snapshot_magic[4] = {'B', 'M', 'Q', 'S'};
+const uint32_t snapshot_version = 1;
+
+struct header_record {
+    char magic[4];
+    uint32_t version;
+    uint32_t device_count;
+    uint32_t object_count;
+    uint32_t point_count;
+    /* 0 in snapshots written before it was kept */
+    uint32_t subscriber_id;
+};
+
+struct device_record {
+    uint32_t device_id;
+    uint32_t max_apdu;
+    uint32_t database_revision;
+    uint32_t first_object;
+    uint32_t object_count;
+    uint16_t net;
+    uint8_t mac_len;
+    uint8_t len;
+    uint8_t mac[MAX_MAC_LEN];
+    uint8_t adr[MAX_MAC_LEN];
+};
+
+struct point_record {
+    uint32_t device_id;
+    uint32_t object;
+    uint32_t tag;
+};
+
+static_assert(sizeof(header_record) % 4 == 0 and sizeof(point_record) == 12);
+
+/* same packing as the BACnet object identifier encoding */
+uint32_t pack_object(const BACNET_OBJECT_ID& object) {
+    return (static_cast<uint32_t>(object.type) << 22) | (object.instance & BACNET_MAX_INSTANCE);
+}
+
+BACNET_OBJECT_ID unpack_object(uint32_t packed) {
+    return {.type = static_cast<BACNET_OBJECT_TYPE>(packed >> 22), .instance = packed & BACNET_MAX_INSTANCE};
+}
+
+}
+
+bool snapshot_save(const std::string& path, const registry_snapshot& snapshot) {
+    std::string tmp_path = path + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr) {
+        fprintf(stderr, "Unable to write snapshot %s\n", tmp_path.c_str());
+        return false;
+    }
+    header_record header = {
+        .version = snapshot_version,
+        .device_count = static_cast<uint32_t>(snapshot.devices.size()),
+        .object_count = 0,
+        .point_count = static_cast<uint32_t>(snapshot.points.size()),
+        .subscriber_id = snapshot.subscriber_id
+    };
+    memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    for (const auto& device: snapshot.devices) {
+        header.object_count += device.object_list.size();
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    uint32_t first_object = 0;
+    for (const auto& device: snapshot.devices) {
+        device_record record = {
+            .device_id = device.device_id,
+            .max_apdu = device.max_apdu,
+            .database_revision = device.database_revision,
+            .first_object = first_object,
+            .object_count = static_cast<uint32_t>(device.object_list.size()),
+            .net = device.address.net,
+            .mac_len = device.address.mac_len,
+            .len = device.address.len
+        };
+        memcpy(record.mac, device.address.mac, sizeof(record.mac));
+        memcpy(record.adr, device.address.adr, sizeof(record.adr));
+        ok = ok and fwrite(&record, sizeof(record), 1, file) == 1;
+        first_object += record.object_count;
+    }
+    for (const auto& device: snapshot.devices) {
+        for (const auto& object: device.object_list) {
+            uint32_t packed = pack_object(object);
+            ok = ok and fwrite(&packed, sizeof(packed), 1, file) == 1;
+        }
+    }
+    for (const auto& point: snapshot.points) {
+        point_record record = {.device_id = point.device_id, .object = pack_object(point.object), .tag = point.tag};
+        ok = ok and fwrite(&record, sizeof(record), 1, file) == 1;
+    }
+    ok = fflush(file) == 0 and ok;
+    ok = fsync(fileno(file)) == 0 and ok;
+    fclose(file);
+    if (not ok or rename(tmp_path.c_str(), path.c_str()) != 0) {
+        fprintf(stderr, "Unable to write snapshot %s\n", path.c_str());
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool snapshot_load(const std::string& path, registry_snapshot& snapshot) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 or static_cast<size_t>(st.st_size) < sizeof(header_record)) {
+        close(fd);
+        return false;
+    }
+    size_t size = st.st_size;
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    const auto *base = static_cast<const uint8_t *>(map);
+    const auto *header = reinterpret_cast<const header_record *>(base);
+    size_t expected = sizeof(header_record)
+        + header->device_count * sizeof(device_record)
+        + header->object_count * sizeof(uint32_t)
+        + header->point_count * sizeof(point_record);
+    if (
+        memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0 or
+        header->version != snapshot_version or
+        expected != size
+    ) {
+        fprintf(stderr, "Ignoring invalid snapshot %s\n", path.c_str());
+        munmap(map, size);
+        return false;
+    }
+    const auto *devices = reinterpret_cast<const device_record *>(base + sizeof(header_record));
+    const auto *objects = reinterpret_cast<const uint32_t *>(devices + header->device_count);
+    const auto *points = reinterpret_cast<const point_record *>(objects + header->object_count);
+
+    snapshot.subscriber_id = header->subscriber_id;
+    snapshot.devices.clear();
+    snapshot.devices.reserve(header->device_count);
+    for (uint32_t i = 0; i < header->device_count; i++) {
+        const device_record& record = devices[i];
+        if (record.first_object + record.object_count > header->object_count) {
+            break;
+        }
+        snapshot_device device = {
+            .device_id = record.device_id,
+            .max_apdu = record.max_apdu,
+            .database_revision = record.database_revision,
+            .address = {.mac_len = record.mac_len, .net = record.net, .len = record.len}
+        };
+        memcpy(device.address.mac, record.mac, sizeof(record.mac));
+        memcpy(device.address.adr, record.adr, sizeof(record.adr));
+        device.object_list.reserve(record.object_count);
+        for (uint32_t j = 0; j < record.object_count; j++) {
+            device.object_list.push_back(unpack_object(objects[record.first_object + j]));
+        }
+        snapshot.devices.push_back(std::move(device));
+    }
+    snapshot.points.clear();
+    snapshot.points.reserve(header->point_count);
+    for (uint32_t i = 0; i < header->point_count; i++) {
+        snapshot.points.push_back({
+            .device_id = points[i].device_id,
+            .object = unpack_object(points[i].object),
+            .tag = points[i].tag
+        });
+    }
+    munmap(map, size);
+    return true;
+}
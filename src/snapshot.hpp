@@ -0,0 +1,34 @@
+#pragma once
+#include <bacnet/bacdef.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* Device and point registry persisted across restarts. On disk it is a
+ * header followed by fixed size device, object and point records, laid out
+ * so the file can be mapped and read in place. Host byte order; the version
+ * is bumped whenever a record changes. */
+struct snapshot_device {
+    uint32_t device_id;
+    uint32_t max_apdu;
+    uint32_t database_revision;
+    BACNET_ADDRESS address;
+    std::vector<BACNET_OBJECT_ID> object_list;
+};
+
+struct snapshot_point {
+    uint32_t device_id;
+    BACNET_OBJECT_ID object;
+    uint32_t tag;
+};
+
+struct registry_snapshot {
+    std::vector<snapshot_device> devices;
+    std::vector<snapshot_point> points;
+    /* subscriberProcessIdentifier of the bridge, 0 when unknown */
+    uint32_t subscriber_id = 0;
+};
+
+/* writes to a temporary file and renames it over path */
+bool snapshot_save(const std::string& path, const registry_snapshot& snapshot);
+bool snapshot_load(const std::string& path, registry_snapshot& snapshot);
@@ -0,0 +1,152 @@
+#include "spool.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+
+struct record_header {
+    uint32_t topic_len;
+    uint32_t payload_len;
+    uint32_t flags;
+};
+
+const uint32_t record_retain = 1;
+
+}
+
+Spool::~Spool() {
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+bool Spool::open(const std::string& path, uint64_t max_bytes) {
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        fprintf(stderr, "Unable to open spool %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(_fd, &st) < 0) {
+        close(_fd);
+        _fd = -1;
+        return false;
+    }
+    _path = path;
+    _max_bytes = max_bytes;
+    _read_offset = 0;
+    _write_offset = st.st_size;
+    return true;
+}
+
+void Spool::reset_() {
+    if (ftruncate(_fd, 0) < 0) {
+        fprintf(stderr, "Unable to truncate spool: %s\n", strerror(errno));
+    }
+    _read_offset = 0;
+    _write_offset = 0;
+    _front_size = 0;
+}
+
+bool Spool::compact_() {
+    std::string compact_path = _path + ".tmp";
+    int fd = ::open(compact_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to compact spool %s: %s\n", _path.c_str(), strerror(errno));
+        return false;
+    }
+    char chunk[65536];
+    for (uint64_t offset = _read_offset; offset < _write_offset;) {
+        ssize_t len = pread(_fd, chunk, std::min<uint64_t>(sizeof(chunk), _write_offset - offset), offset);
+        if (len <= 0 or write(fd, chunk, len) != len) {
+            fprintf(stderr, "Unable to compact spool %s: %s\n", _path.c_str(), strerror(errno));
+            close(fd);
+            unlink(compact_path.c_str());
+            return false;
+        }
+        offset += len;
+    }
+    if (rename(compact_path.c_str(), _path.c_str()) < 0) {
+        fprintf(stderr, "Unable to compact spool %s: %s\n", _path.c_str(), strerror(errno));
+        close(fd);
+        unlink(compact_path.c_str());
+        return false;
+    }
+    close(_fd);
+    _fd = fd;
+    _write_offset -= _read_offset;
+    _read_offset = 0;
+    return true;
+}
+
+bool Spool::append(std::string_view topic, std::string_view payload, bool retain) {
+    if (_fd < 0) {
+        return false;
+    }
+    record_header header = {
+        .topic_len = static_cast<uint32_t>(topic.size()),
+        .payload_len = static_cast<uint32_t>(payload.size()),
+        .flags = retain ? record_retain : 0
+    };
+    uint64_t record_size = sizeof(header) + topic.size() + payload.size();
+    if (size() + record_size > _max_bytes) {
+        return false;
+    }
+    if (_read_offset >= _max_bytes) {
+        /* keeps the file below twice the cap, the spool goes on without */
+        compact_();
+    }
+    struct iovec parts[3] = {
+        {.iov_base = &header, .iov_len = sizeof(header)},
+        {.iov_base = const_cast<char *>(topic.data()), .iov_len = topic.size()},
+        {.iov_base = const_cast<char *>(payload.data()), .iov_len = payload.size()},
+    };
+    ssize_t written = writev(_fd, parts, 3);
+    if (written != static_cast<ssize_t>(record_size)) {
+        /* drop a partial record so the reader never sees it */
+        if (ftruncate(_fd, _write_offset) < 0 or written < 0) {
+            fprintf(stderr, "Spool write error: %s\n", strerror(errno));
+        }
+        return false;
+    }
+    _write_offset += record_size;
+    return true;
+}
+
+bool Spool::front(std::string_view& topic, std::string_view& payload, bool& retain) {
+    if (_fd < 0 or empty()) {
+        return false;
+    }
+    record_header header;
+    if (pread(_fd, &header, sizeof(header), _read_offset) != sizeof(header) or
+            _read_offset + sizeof(header) + header.topic_len + header.payload_len > _write_offset) {
+        /* torn tail left by a crash, nothing after it is usable */
+        fprintf(stderr, "Discarding truncated spool record at %llu\n", static_cast<unsigned long long>(_read_offset));
+        reset_();
+        return false;
+    }
+    _buffer.resize(header.topic_len + header.payload_len);
+    if (pread(_fd, _buffer.data(), _buffer.size(), _read_offset + sizeof(header)) != static_cast<ssize_t>(_buffer.size())) {
+        reset_();
+        return false;
+    }
+    _front_size = sizeof(header) + _buffer.size();
+    topic = std::string_view(_buffer.data(), header.topic_len);
+    payload = std::string_view(_buffer.data() + header.topic_len, header.payload_len);
+    retain = header.flags & record_retain;
+    return true;
+}
+
+void Spool::pop() {
+    _read_offset += _front_size;
+    _front_size = 0;
+    if (empty()) {
+        reset_();
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+/* Append-only on-disk spool of outbound MQTT messages for broker outages.
+ * Each record is a small header with the topic and payload lengths and the
+ * retain flag, followed by both byte strings. Records are read back in the
+ * order they were written; the file is truncated once everything has been
+ * replayed, so a spool left behind by a previous run is replayed after a
+ * restart. The size cap applies to the records not replayed yet; the
+ * replayed ones are dropped by copying the rest to a new file once they
+ * take up the cap themselves. */
+class Spool {
+public:
+    ~Spool();
+    bool open(const std::string& path, uint64_t max_bytes);
+    bool is_open() const {
+        return _fd >= 0;
+    }
+    bool empty() const {
+        return _read_offset == _write_offset;
+    }
+    uint64_t size() const {
+        return _write_offset - _read_offset;
+    }
+    /* false when the record would exceed the size cap or the write failed */
+    bool append(std::string_view topic, std::string_view payload, bool retain);
+    /* oldest record, the views stay valid until the next call */
+    bool front(std::string_view& topic, std::string_view& payload, bool& retain);
+    void pop();
+
+private:
+    int _fd = -1;
+    std::string _path;
+    uint64_t _max_bytes = 0;
+    uint64_t _read_offset = 0;
+    uint64_t _write_offset = 0;
+    uint64_t _front_size = 0;
+    std::string _buffer;
+
+    void reset_();
+    bool compact_();
+};
@@ -0,0 +1,294 @@
+#include "supervisor.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+typedef std::chrono::steady_clock clock;
+
+/* a worker that dies sooner than this after its start is crashing */
+const std::chrono::seconds stable_uptime(10);
+const std::chrono::seconds max_restart_delay(60);
+
+worker_metrics *metrics_slot = nullptr;
+
+struct worker {
+    trunk_config trunk;
+    worker_metrics *metrics;
+    pid_t pid = -1;
+    clock::time_point started;
+    clock::time_point restart_at;
+    std::chrono::seconds restart_delay{1};
+    /* exited with status 0, it is not restarted */
+    bool finished = false;
+};
+
+void append_env(const char *name, const std::string& suffix) {
+    const char *value = getenv(name);
+    if (value) {
+        setenv(name, (std::string(value) + suffix).c_str(), 1);
+    }
+}
+
+/* returns true in the new worker */
+bool start_worker(worker& worker, const sigset_t& worker_mask) {
+    /* nothing buffered may be written twice */
+    fflush(nullptr);
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Unable to start worker %s: %s\n", worker.trunk.name.c_str(), strerror(errno));
+        worker.restart_at = clock::now() + worker.restart_delay;
+        return false;
+    }
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        sigprocmask(SIG_SETMASK, &worker_mask, nullptr);
+        setenv("BACNET_IFACE", worker.trunk.iface.c_str(), 1);
+        setenv("BACNET_TOPIC_PREFIX", (worker.trunk.name + "/").c_str(), 1);
+        append_env("BACNET_SNAPSHOT", "." + worker.trunk.name);
+        append_env("MQTT_SPOOL", "." + worker.trunk.name);
+        append_env("MQTT_CLIENT_ID", "-" + worker.trunk.name);
+        if (worker.trunk.cpu >= 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(worker.trunk.cpu, &cpus);
+            if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+                fprintf(stderr, "Unable to pin worker %s to CPU %d: %s\n",
+                    worker.trunk.name.c_str(), worker.trunk.cpu, strerror(errno));
+            }
+        }
+        metrics_slot = worker.metrics;
+        metrics_slot->pid.store(getpid());
+        return true;
+    }
+    worker.pid = pid;
+    worker.started = clock::now();
+    fprintf(stderr, "Started worker %s on %s, pid %d\n", worker.trunk.name.c_str(), worker.trunk.iface.c_str(), pid);
+    return false;
+}
+
+void report(const std::vector<worker>& workers, const char *path) {
+    worker_metrics total;
+    for (const auto& worker: workers) {
+        const worker_metrics& metrics = *worker.metrics;
+        total.restarts += metrics.restarts;
+        total.points += metrics.points;
+        total.notifications += metrics.notifications;
+        total.published += metrics.published;
+        total.dropped += metrics.dropped;
+        total.requests += metrics.requests;
+        total.timeouts += metrics.timeouts;
+        total.queue_depth += metrics.queue_depth;
+    }
+    fprintf(
+        stderr,
+        "Workers: %zu, points: %llu, notifications: %llu, published: %llu, dropped: %llu, "
+        "requests: %llu, timeouts: %llu, queued: %llu, restarts: %llu\n",
+        workers.size(),
+        static_cast<unsigned long long>(total.points.load()),
+        static_cast<unsigned long long>(total.notifications.load()),
+        static_cast<unsigned long long>(total.published.load()),
+        static_cast<unsigned long long>(total.dropped.load()),
+        static_cast<unsigned long long>(total.requests.load()),
+        static_cast<unsigned long long>(total.timeouts.load()),
+        static_cast<unsigned long long>(total.queue_depth.load()),
+        static_cast<unsigned long long>(total.restarts.load())
+    );
+    if (path == nullptr) {
+        return;
+    }
+    std::string tmp_path = std::string(path) + ".tmp";
+    FILE *file = fopen(tmp_path.c_str(), "w");
+    if (file == nullptr) {
+        fprintf(stderr, "Unable to write metrics %s\n", tmp_path.c_str());
+        return;
+    }
+    auto write = [file](const char *name, const worker_metrics& metrics) {
+        fprintf(
+            file,
+            "%s pid=%lld points=%llu notifications=%llu published=%llu dropped=%llu "
+            "requests=%llu timeouts=%llu queued=%llu restarts=%llu\n",
+            name,
+            static_cast<long long>(metrics.pid.load()),
+            static_cast<unsigned long long>(metrics.points.load()),
+            static_cast<unsigned long long>(metrics.notifications.load()),
+            static_cast<unsigned long long>(metrics.published.load()),
+            static_cast<unsigned long long>(metrics.dropped.load()),
+            static_cast<unsigned long long>(metrics.requests.load()),
+            static_cast<unsigned long long>(metrics.timeouts.load()),
+            static_cast<unsigned long long>(metrics.queue_depth.load()),
+            static_cast<unsigned long long>(metrics.restarts.load())
+        );
+    };
+    for (const auto& worker: workers) {
+        write(worker.trunk.name.c_str(), *worker.metrics);
+    }
+    write("total", total);
+    fclose(file);
+    rename(tmp_path.c_str(), path);
+}
+
+}
+
+bool parse_trunks(const std::string& spec, std::vector<trunk_config>& trunks) {
+    size_t start = 0;
+    while (start <= spec.size()) {
+        size_t end = spec.find(';', start);
+        std::string entry = spec.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        start = end == std::string::npos ? spec.size() + 1 : end + 1;
+        if (entry.empty()) {
+            continue;
+        }
+        size_t equals = entry.find('=');
+        if (equals == 0 or equals == std::string::npos) {
+            return false;
+        }
+        trunk_config trunk;
+        trunk.name = entry.substr(0, equals);
+        size_t at = entry.find('@', equals);
+        trunk.iface = entry.substr(equals + 1, at == std::string::npos ? std::string::npos : at - equals - 1);
+        if (at != std::string::npos) {
+            char *cpu_end = nullptr;
+            trunk.cpu = static_cast<int>(strtol(entry.c_str() + at + 1, &cpu_end, 10));
+            if (*cpu_end != '\0' or trunk.cpu < 0) {
+                return false;
+            }
+        }
+        if (trunk.iface.empty() or trunk.name.find('/') != std::string::npos) {
+            return false;
+        }
+        trunks.push_back(trunk);
+    }
+    return not trunks.empty();
+}
+
+void supervise(const std::vector<trunk_config>& trunks) {
+    void *shared = mmap(nullptr, sizeof(worker_metrics) * trunks.size(),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        fprintf(stderr, "Unable to map the worker metrics: %s\n", strerror(errno));
+        exit(-1);
+    }
+    std::vector<worker> workers;
+    for (size_t i = 0; i < trunks.size(); i++) {
+        workers.push_back({.trunk = trunks[i], .metrics = new (static_cast<worker_metrics *>(shared) + i) worker_metrics()});
+    }
+
+    sigset_t signals;
+    sigset_t worker_mask;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGCHLD);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &signals, &worker_mask);
+
+    for (auto& worker: workers) {
+        if (start_worker(worker, worker_mask)) {
+            return;
+        }
+    }
+
+    const char *metrics_path = getenv("BACNET_SUPERVISOR_METRICS");
+    const char *report_interval_env = getenv("BACNET_SUPERVISOR_REPORT_S");
+    std::chrono::seconds report_interval(report_interval_env ? std::stoul(report_interval_env) : 60);
+    /* 0 disables the periodic report */
+    auto next_report = report_interval.count() > 0 ? clock::now() + report_interval : clock::time_point::max();
+    bool stopping = false;
+    for (;;) {
+        auto now = clock::now();
+        auto wake = next_report;
+        for (const auto& worker: workers) {
+            if (worker.pid < 0 and not worker.finished and not stopping) {
+                wake = std::min(wake, worker.restart_at);
+            }
+        }
+        auto timeout = std::chrono::ceil<std::chrono::milliseconds>(std::max(wake - now, clock::duration::zero()));
+        struct timespec ts = {
+            .tv_sec = static_cast<time_t>(timeout.count() / 1000),
+            .tv_nsec = static_cast<long>(timeout.count() % 1000) * 1000000L
+        };
+        int sig = sigtimedwait(&signals, nullptr, wake == clock::time_point::max() ? nullptr : &ts);
+        if ((sig == SIGTERM or sig == SIGINT) and not stopping) {
+            stopping = true;
+            for (const auto& worker: workers) {
+                if (worker.pid > 0) {
+                    kill(worker.pid, SIGTERM);
+                }
+            }
+        }
+        if (sig == SIGHUP) {
+            /* point selection reload */
+            for (const auto& worker: workers) {
+                if (worker.pid > 0) {
+                    kill(worker.pid, SIGHUP);
+                }
+            }
+        }
+
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            auto worker_it = std::find_if(workers.begin(), workers.end(), [pid](const worker& worker) {
+                return worker.pid == pid;
+            });
+            if (worker_it == workers.end()) {
+                continue;
+            }
+            auto& worker = *worker_it;
+            worker.pid = -1;
+            worker.metrics->pid.store(0);
+            if (WIFSIGNALED(status)) {
+                fprintf(stderr, "Worker %s killed by signal %d\n", worker.trunk.name.c_str(), WTERMSIG(status));
+            } else if (WEXITSTATUS(status) == 0) {
+                /* e.g. stopped by a SIGTERM of its own, after cancelling its subscriptions */
+                fprintf(stderr, "Worker %s finished\n", worker.trunk.name.c_str());
+                worker.finished = true;
+            } else {
+                fprintf(stderr, "Worker %s exited with status %d\n", worker.trunk.name.c_str(), WEXITSTATUS(status));
+            }
+            if (stopping or worker.finished) {
+                continue;
+            }
+            now = clock::now();
+            worker.restart_delay = now - worker.started < stable_uptime ?
+                std::min(worker.restart_delay * 2, max_restart_delay) : std::chrono::seconds(1);
+            worker.restart_at = now + worker.restart_delay;
+            worker.metrics->restarts++;
+        }
+
+        bool all_finished = std::all_of(workers.begin(), workers.end(), [](const worker& worker) { return worker.finished; });
+        if (stopping or all_finished) {
+            if (std::all_of(workers.begin(), workers.end(), [](const worker& worker) { return worker.pid < 0; })) {
+                report(workers, metrics_path);
+                exit(0);
+            }
+            continue;
+        }
+        now = clock::now();
+        for (auto& worker: workers) {
+            if (worker.pid < 0 and not worker.finished and now >= worker.restart_at and start_worker(worker, worker_mask)) {
+                return;
+            }
+        }
+        if (now >= next_report) {
+            next_report = now + report_interval;
+            report(workers, metrics_path);
+        }
+    }
+}
+
+worker_metrics *supervised_metrics() {
+    return metrics_slot;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* one MS/TP port served by its own worker process */
+struct trunk_config {
+    /* topic prefix and suffix of the per worker files */
+    std::string name;
+    /* BACNET_IFACE of the worker */
+    std::string iface;
+    /* pinned to this CPU, -1 for no affinity */
+    int cpu = -1;
+};
+
+/* counters a worker shares with the supervisor, pid and restarts are kept
+ * by the supervisor, the rest is written by the worker */
+struct worker_metrics {
+    std::atomic<int64_t> pid;
+    std::atomic<uint64_t> restarts;
+    std::atomic<uint64_t> points;
+    std::atomic<uint64_t> notifications;
+    std::atomic<uint64_t> published;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> timeouts;
+    std::atomic<uint64_t> queue_depth;
+};
+
+/* "<name>=<iface>[@<cpu>];..." */
+bool parse_trunks(const std::string& spec, std::vector<trunk_config>& trunks);
+
+/* Forks one worker per trunk and supervises them: a worker that exits is
+ * restarted with a backoff when it keeps crashing, SIGTERM and SIGINT are
+ * forwarded and the aggregated metrics are logged periodically and written
+ * to BACNET_SUPERVISOR_METRICS. bacnet-stack keeps its state in globals, so
+ * every trunk needs a process of its own.
+ *
+ * Only returns in a worker, with BACNET_IFACE, BACNET_TOPIC_PREFIX and the
+ * per worker snapshot, spool and client id set in its environment. The
+ * supervisor exits when its workers are gone after a shutdown signal. */
+void supervise(const std::vector<trunk_config>& trunks);
+
+/* the shared metrics slot of this worker, nullptr when not supervised */
+worker_metrics *supervised_metrics();
@@ -0,0 +1,84 @@
+#include "topic_parser.hpp"
+#include <bacnet/bactext.h>
+#include <algorithm>
+#include <charconv>
+
+namespace {
+
+bool parse_uint(std::string_view text, uint32_t& value) {
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+    return not text.empty() and result.ec == std::errc() and result.ptr == text.data() + text.size();
+}
+
+/* next '/' separated element; the rest becomes a null view after the last
+ * element, so a trailing '/' leaves an empty but non-null one */
+std::string_view next_element(std::string_view& topic) {
+    size_t slash = topic.find('/');
+    std::string_view element = topic.substr(0, slash);
+    topic = slash == std::string_view::npos ? std::string_view() : topic.substr(slash + 1);
+    return element;
+}
+
+}
+
+TopicParser::TopicParser() {
+    for (unsigned type = 0; type < MAX_BACNET_OBJECT_TYPE; type++) {
+        const char *name = bactext_object_type_name(type);
+        unsigned found = 0;
+        /* the reserved and proprietary ranges share one name */
+        if (name and bactext_object_type_strtol(name, &found) and found == type) {
+            _types.emplace_back(name, static_cast<BACNET_OBJECT_TYPE>(type));
+        }
+    }
+    std::sort(_types.begin(), _types.end());
+}
+
+bool TopicParser::parse_type(std::string_view text, BACNET_OBJECT_TYPE& type) const {
+    uint32_t number;
+    if (parse_uint(text, number)) {
+        if (number >= MAX_BACNET_OBJECT_TYPE) {
+            return false;
+        }
+        type = static_cast<BACNET_OBJECT_TYPE>(number);
+        return true;
+    }
+    auto type_it = std::lower_bound(_types.begin(), _types.end(), text, [](const auto& entry, std::string_view name) {
+        return entry.first < name;
+    });
+    if (type_it == _types.end() or type_it->first != text) {
+        return false;
+    }
+    type = type_it->second;
+    return true;
+}
+
+bool TopicParser::parse(std::string_view topic, point_topic& parsed) const {
+    std::string_view verb = next_element(topic);
+    if (verb == "bacnet-in") {
+        parsed.action = topic_action::write;
+    } else if (verb == "bacnet-get") {
+        parsed.action = topic_action::read;
+    } else {
+        return false;
+    }
+    if (
+        not parse_uint(next_element(topic), parsed.device_id) or
+        not parse_type(next_element(topic), parsed.object_type) or
+        not parse_uint(next_element(topic), parsed.instance) or
+        parsed.device_id > BACNET_MAX_INSTANCE or
+        parsed.instance > BACNET_MAX_INSTANCE
+    ) {
+        return false;
+    }
+    parsed.priority = 0;
+    if (topic.data() == nullptr) {
+        return true;
+    }
+    uint32_t priority;
+    if (parsed.action != topic_action::write or not parse_uint(next_element(topic), priority) or priority > BACNET_MAX_PRIORITY) {
+        return false;
+    }
+    parsed.priority = static_cast<uint8_t>(priority);
+    /* nothing may follow the priority */
+    return topic.data() == nullptr;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <bacnet/bacdef.h>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+enum class topic_action : uint8_t {
+    /* bacnet-in/<id>/<type>/<instance>[/<priority>] */
+    write,
+    /* bacnet-get/<id>/<type>/<instance> */
+    read
+};
+
+struct point_topic {
+    topic_action action;
+    uint32_t device_id;
+    BACNET_OBJECT_TYPE object_type;
+    uint32_t instance;
+    /* 1 .. 16, 0 when the topic has none */
+    uint8_t priority;
+};
+
+/* Parses inbound topics (without the topic prefix) in place: no allocation
+ * and no exceptions, every malformed topic just returns false. <type> is an
+ * object type name as in the published topics or its number; the names are
+ * looked up in a table sorted once at construction. */
+class TopicParser {
+public:
+    TopicParser();
+    bool parse(std::string_view topic, point_topic& parsed) const;
+    bool parse_type(std::string_view text, BACNET_OBJECT_TYPE& type) const;
+
+private:
+    /* the stack's static name strings, sorted by name */
+    std::vector<std::pair<std::string_view, BACNET_OBJECT_TYPE>> _types;
+};
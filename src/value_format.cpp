@@ -0,0 +1,51 @@
+#include "value_format.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
+namespace {
+
+template <typename T>
+size_t format_number(T number, char *buffer, size_t size) {
+    auto result = std::to_chars(buffer, buffer + size, number);
+    return result.ec == std::errc() ? result.ptr - buffer : 0;
+}
+
+size_t format_bytes(const void *bytes, size_t length, char *buffer, size_t size) {
+    length = std::min(length, size);
+    memcpy(buffer, bytes, length);
+    return length;
+}
+
+}
+
+size_t format_value(const BACNET_APPLICATION_DATA_VALUE& value, char *buffer, size_t size) {
+    switch (value.tag) {
+        case BACNET_APPLICATION_TAG_BOOLEAN:
+            return format_number(value.type.Boolean ? 1 : 0, buffer, size);
+        case BACNET_APPLICATION_TAG_UNSIGNED_INT:
+            return format_number(value.type.Unsigned_Int, buffer, size);
+        case BACNET_APPLICATION_TAG_SIGNED_INT:
+            return format_number(value.type.Signed_Int, buffer, size);
+        case BACNET_APPLICATION_TAG_REAL:
+            return format_number(value.type.Real, buffer, size);
+        case BACNET_APPLICATION_TAG_DOUBLE:
+            return format_number(value.type.Double, buffer, size);
+        case BACNET_APPLICATION_TAG_OCTET_STRING:
+            return format_bytes(value.type.Octet_String.value, value.type.Octet_String.length, buffer, size);
+        case BACNET_APPLICATION_TAG_CHARACTER_STRING:
+            return format_bytes(value.type.Character_String.value, value.type.Character_String.length, buffer, size);
+        case BACNET_APPLICATION_TAG_BIT_STRING: {
+            const BACNET_BIT_STRING& bits = value.type.Bit_String;
+            size_t length = std::min<size_t>({bits.bits_used, size, MAX_BITSTRING_BYTES * 8});
+            for (size_t bit = 0; bit < length; bit++) {
+                buffer[bit] = (bits.value[bit / 8] & (1 << (bit % 8))) ? '1' : '0';
+            }
+            return length;
+        }
+        case BACNET_APPLICATION_TAG_ENUMERATED:
+            return format_number(value.type.Enumerated, buffer, size);
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include <bacnet/bacdef.h>
+#include <bacnet/bacapp.h>
+#include <cstddef>
+
+/* large enough for any value format_value() produces */
+static constexpr size_t value_buffer_size = MAX_CHARACTER_STRING_BYTES + 1;
+
+/* Writes the text form of value into buffer without allocating and returns
+ * its length. Numbers use the shortest representation that round trips,
+ * bit strings are written as one '0' or '1' per bit. */
+size_t format_value(const BACNET_APPLICATION_DATA_VALUE& value, char *buffer, size_t size);